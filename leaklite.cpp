@@ -111,3 +111,15 @@ void operator delete[](void * ptr) noexcept
 {
   leaklite_delete(ptr, NULL, NULL, 0, NEW_ARR); 
 }
+
+#if defined(__cpp_aligned_new)
+void operator delete(void *ptr, std::align_val_t al) noexcept
+{
+  leaklite_delete(ptr, NULL, NULL, 0, ALIGN_NEW);
+}
+
+void operator delete[](void *ptr, std::align_val_t al) noexcept
+{
+  leaklite_delete(ptr, NULL, NULL, 0, ALIGN_NEW_ARR);
+}
+#endif
@@ -34,10 +34,46 @@
 #include "ck_pr.h"
 #include "pointer_hash.h"
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#ifdef LEAKLITE_TRACE
+#include "leaklite_trace.h"
+#endif
+#ifdef LEAKLITE_WRAP
+#include "leaklite_wrap.h"
+#endif
+#ifdef LEAKLITE_THREADS
+#include "leaklite_threads.h"
+#endif
+#ifdef LEAKLITE_JEMALLOC
+#include "leaklite_jemalloc.h"
+#endif
+#ifdef LEAKLITE_RESIDENT
+#include "leaklite_resident.h"
+#endif
+
+// The C++20 source_location mode in leaklite.hpp hands trackers over directly, the same way the
+// non-lambda mode does, and does not redefine any allocation macros.
+#if defined(LEAKLITE_SOURCE_LOCATION) && !defined(NO_LAMBDA_LEAKLITE)
+#define NO_LAMBDA_LEAKLITE 1
+#endif
 
-typedef enum { NOT_SET, MALLOC, CALLOC, NEW, NEW_ARR, ALIGN_NEW, ALIGN_NEW_ARR } leaklite_type;
+typedef enum {
+  NOT_SET, MALLOC, CALLOC, NEW, NEW_ARR, ALIGN_NEW, ALIGN_NEW_ARR, REALLOC
+} leaklite_type;
 static const char *leaklite_type_str[] = {"not set", "malloc", "calloc", "new", "new[]",
-                                          "al new", "al new[]"};
+                                          "al new", "al new[]", "realloc"};
+
+// With LEAKLITE_WRAP the linker routes malloc and free through leaklite_wrap.c, so blocks that
+// an instrumented site already tracks go straight to the real allocator instead.
+#ifdef LEAKLITE_WRAP
+#define leaklite_real_malloc __real_malloc
+#define leaklite_real_free __real_free
+#else
+#define leaklite_real_malloc malloc
+#define leaklite_real_free free
+#endif
 
 struct leaklite_alloc_tracker;
 typedef struct leaklite_alloc_tracker {
@@ -50,14 +86,47 @@ typedef struct leaklite_alloc_tracker {
   uint64_t num_frees;
   bool was_linked;
   struct leaklite_alloc_tracker *next;
+  uint32_t trace_id;
+  uint64_t xthread_frees;
+  uint64_t active_usable;
+  uint64_t active_resident;
 } leaklite_alloc_tracker_t;
 
 typedef struct {
   uint64_t guard;
   uint64_t size;
   leaklite_alloc_tracker_t *tracker;
+#ifdef LEAKLITE_THREADS
+  uint64_t owner;
+#endif
+#ifdef LEAKLITE_JEMALLOC
+  uint64_t usable;
+#endif
+#ifdef LEAKLITE_RESIDENT
+  struct leaklite_resident_block *resident;
+#endif
 } leaklite_trailer_t;
 
+// Inserts item into out, an array of at most max_out entries of size bytes that holds found of
+// them in compar order (as for qsort), dropping the last entry once it is full.  Returns the new
+// count.
+static inline size_t leaklite_rank_insert(void *out, size_t found, size_t max_out, size_t size,
+                                          const void *item,
+                                          int (*compar)(const void *, const void *))
+{
+  char *base = (char *)out;
+  size_t pos = found < max_out ? found : max_out;
+  while (pos > 0 && compar(base + (pos - 1) * size, item) > 0) {
+    if (pos < max_out) memcpy(base + pos * size, base + (pos - 1) * size, size);
+    pos--;
+  }
+  if (pos < max_out) {
+    memcpy(base + pos * size, item, size);
+    if (found < max_out) found++;
+  }
+  return found;
+}
+
 extern leaklite_alloc_tracker_t *tracker_head;
 static pthread_mutex_t tracker_head_mutex = PTHREAD_MUTEX_INITIALIZER;
 #ifdef NO_LAMBDA_LEAKLITE
@@ -70,13 +139,26 @@ static inline void *leaklite_alloc(size_t size, size_t *align,
 #endif
 {
   void *ret = NULL;
+  // the trailer goes at ret + size, a wrapped size would put it in front of the block
+  if (size > SIZE_MAX - sizeof(leaklite_trailer_t)) {
+    errno = ENOMEM;
+    return NULL;
+  }
+#ifdef LEAKLITE_JEMALLOC
+  int flags = leaklite_mallocx_flags();
+  if (align) {
+    flags |= MALLOCX_ALIGN(*align);
+  }
+  ret = mallocx(size + sizeof(leaklite_trailer_t), flags);
+#else
   if (align) {
     size_t addsize = (sizeof(leaklite_trailer_t) / *align) * *align + *align;
     ret = aligned_alloc(size + addsize, *align);
   }
   else {
-    ret = malloc(size + sizeof(leaklite_trailer_t));
+    ret = leaklite_real_malloc(size + sizeof(leaklite_trailer_t));
   }
+#endif
   if (ret) {
     leaklite_trailer_t *trailer = (leaklite_trailer_t *)((char *)ret + size);
     if (!pointer_hash_insert((char *)ret, (uint64_t)trailer))
@@ -84,12 +166,24 @@ static inline void *leaklite_alloc(size_t size, size_t *align,
 //      log_error("ERROR - Leaklite pointer hash collision\n");
     }
     trailer->size = size;
+#ifdef LEAKLITE_THREADS
+    trailer->owner = leaklite_thread_alloc(size);
+#endif
 #ifndef NO_LAMBDA_LEAKLITE
     leaklite_alloc_tracker_t *tracker = get_tracker();
 #endif
     trailer->tracker = tracker;
     ck_pr_inc_64(&tracker->active_allocs);
     ck_pr_add_64(&tracker->active_memsize, size);
+#ifdef LEAKLITE_JEMALLOC
+    // the size class, trailer included; nallocx gives the same answer as sallocx without a lookup
+    trailer->usable = nallocx(size + sizeof(leaklite_trailer_t), flags);
+    ck_pr_add_64(&tracker->active_usable, trailer->usable);
+#endif
+#ifdef LEAKLITE_RESIDENT
+    trailer->resident = size >= LEAKLITE_RESIDENT_MIN ? leaklite_resident_add(ret, size, tracker)
+                                                      : NULL;
+#endif
     if (!tracker->was_linked) {
       pthread_mutex_lock(&tracker_head_mutex);
       tracker->type = type;
@@ -97,10 +191,15 @@ static inline void *leaklite_alloc(size_t size, size_t *align,
       tracker->fname = fname;
 #endif
       tracker->next = tracker_head;
+      // the history sampler walks the list without this mutex
+      ck_pr_fence_store();
       tracker_head = tracker;
       tracker->was_linked = true;
       pthread_mutex_unlock(&tracker_head_mutex);
     }
+#ifdef LEAKLITE_TRACE
+    leaklite_trace_alloc(tracker, ret, size);
+#endif
   }
   return ret;
 }
@@ -132,7 +231,9 @@ static inline void *leaklite_calloc(size_t count, size_t size, size_t *align, co
 #else
   void *ret = leaklite_alloc(count * size, align, get_tracker, CALLOC, fname);
 #endif
-  memset(ret, 0, count * size);
+  if (ret) {
+    memset(ret, 0, count * size);
+  }
   return ret;
 }
 
@@ -160,18 +261,39 @@ static inline void leaklite_free(void *ptr, const char *fname, const char *srcfi
         ck_pr_dec_64(&tracker->active_allocs);
         ck_pr_sub_64(&tracker->active_memsize, size);
         ck_pr_inc_64(&tracker->num_frees);
+#ifdef LEAKLITE_THREADS
+        if (leaklite_thread_free((*trailer)->owner, size)) {
+          ck_pr_inc_64(&tracker->xthread_frees);
+        }
+#endif
+#ifdef LEAKLITE_TRACE
+        leaklite_trace_free(tracker, ptr, size);
+#endif
+#ifdef LEAKLITE_JEMALLOC
+        uint64_t usable = (*trailer)->usable;
+        ck_pr_sub_64(&tracker->active_usable, usable);
+#endif
+#ifdef LEAKLITE_RESIDENT
+        if ((*trailer)->resident) {
+          leaklite_resident_remove((*trailer)->resident);
+        }
+#endif
         (*trailer)->tracker = NULL;
         pointer_hash_remove(ptr);
+#ifdef LEAKLITE_JEMALLOC
+        sdallocx(ptr, usable, leaklite_mallocx_flags());
+        return;
+#endif
       }
     }
-    free(ptr);
+    leaklite_real_free(ptr);
   }
 }
 
 #define CONCAT(first, second) CONCAT_SIMPLE(first, second)
 #define CONCAT_SIMPLE(first, second) first ## second
 
-#ifdef DISABLE_LEAKLITE
+#if defined(DISABLE_LEAKLITE) || defined(LEAKLITE_SOURCE_LOCATION)
 #define __LEAKLITE__
 #else
 #ifdef NO_LAMBDA_LEAKLITE
@@ -214,22 +336,70 @@ static inline void leaklite_free(void *ptr, const char *fname, const char *srcfi
 #endif
 #endif
 
+#ifndef LEAKLITE_SOURCE_LOCATION
 #define free(ptr) \
   leaklite_free(ptr, __FUNCTION__, __FILE__, __LINE__)
+#endif
 
 static inline void leaklite_dump()
 {
+#ifdef LEAKLITE_WRAP
+  leaklite_wrap_resolve();
+#endif
+#ifdef LEAKLITE_RESIDENT
+  leaklite_resident_scan(LEAKLITE_RESIDENT_SCAN_PAGES);
+#endif
   leaklite_alloc_tracker_t *curr = tracker_head;
   printf("LEAKLITE MEMORY DUMP:\n");
   uint64_t total = 0;
+#ifdef LEAKLITE_JEMALLOC
+  uint64_t total_usable = 0;
+#endif
   while (curr) {
-    printf("%" PRIu64 " bytes (%" PRIu64 " unfreed, %" PRIu64 " freed) %s %s:%u (%s)\n",
-           curr->active_memsize, curr->active_allocs, curr->num_frees, leaklite_type_str[curr->type],
-           curr->fname, curr->linenum, curr->srcfile);
+    printf("%" PRIu64 " bytes", curr->active_memsize);
+#ifdef LEAKLITE_JEMALLOC
+    printf(" (%" PRIu64 " usable)", curr->active_usable);
+    total_usable = total_usable + curr->active_usable;
+#endif
+#ifdef LEAKLITE_RESIDENT
+    printf(" (%" PRIu64 " resident)", curr->active_resident);
+#endif
+    printf(" (%" PRIu64 " unfreed, %" PRIu64 " freed", curr->active_allocs, curr->num_frees);
+#ifdef LEAKLITE_THREADS
+    printf(", %" PRIu64 " on another thread", curr->xthread_frees);
+#endif
+    printf(") %s %s:%u (%s)\n", leaklite_type_str[curr->type], curr->fname, curr->linenum,
+           curr->srcfile);
     total = total + curr->active_memsize;
     curr = curr->next;
   }
   printf("%" PRIu64 " total monitored allocated memory\n", total);
+#ifdef LEAKLITE_JEMALLOC
+  printf("%" PRIu64 " total usable, trailers included\n", total_usable);
+#ifdef LEAKLITE_JEMALLOC_ARENA
+  size_t allocated, resident, mapped;
+  if (leaklite_jemalloc_arena_stats(&allocated, &resident, &mapped)) {
+    printf("%zu allocated, %zu resident, %zu mapped in the leaklite arena\n", allocated,
+           resident, mapped);
+  }
+#endif
+#endif
+#ifdef LEAKLITE_RESIDENT
+  leaklite_resident_stats_t large;
+  leaklite_resident_stats(&large);
+  printf("%" PRIu64 " of %" PRIu64 " bytes resident in %" PRIu64 " blocks of at least %u bytes"
+         " (%" PRIu64 " full passes)\n", large.resident, large.bytes, large.blocks,
+         (unsigned)LEAKLITE_RESIDENT_MIN, large.passes);
+#endif
+#ifdef LEAKLITE_THREADS
+  leaklite_thread_usage_t threads[LEAKLITE_THREAD_SLOTS];
+  size_t num_threads = leaklite_thread_usage(threads, LEAKLITE_THREAD_SLOTS);
+  for (size_t i = 0; i < num_threads; i++) {
+    printf("%" PRIu64 " bytes (%" PRIu64 " unfreed) thread %d %s (slot %u)\n",
+           threads[i].live_bytes, threads[i].live_blocks, (int)threads[i].tid, threads[i].name,
+           threads[i].slot);
+  }
+#endif
 }
 
 #endif
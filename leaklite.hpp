@@ -43,8 +43,8 @@ enum class align_val_t: size_t {};
 #endif
 
 #ifdef NO_LAMBDA_LEAKLITE
-static inline void *leaklite_new(size_t size, size_t *align, leaklite_alloc_tracker_t *tracker,
-                                 leaklite_type type)
+static inline void *leaklite_new(size_t size, std::align_val_t *align,
+                                 leaklite_alloc_tracker_t *tracker, leaklite_type type)
 #else
 static inline void *leaklite_new(size_t size, std::align_val_t *align,
                                  leaklite_alloc_tracker_t *(*get_tracker)(), leaklite_type type,
@@ -59,8 +59,20 @@ static inline void *leaklite_new(size_t size, std::align_val_t *align,
     else ret = ::operator new[](size + addsize, *align);
   }
   else {
-*/    if (type == NEW) ret = ::operator new(size + sizeof(leaklite_trailer_t));
+*/
+#ifdef LEAKLITE_JEMALLOC
+    int flags = leaklite_mallocx_flags();
+    if (align) {
+      flags |= MALLOCX_ALIGN((size_t)*align);
+    }
+    ret = mallocx(size + sizeof(leaklite_trailer_t), flags);
+    if (!ret) {
+      throw std::bad_alloc();
+    }
+#else
+    if (type == NEW) ret = ::operator new(size + sizeof(leaklite_trailer_t));
     else ret = ::operator new[](size + sizeof(leaklite_trailer_t));
+#endif
 //  }
   if (ret) {
     leaklite_trailer_t *trailer = (leaklite_trailer_t *)((char *)ret + size);
@@ -69,6 +81,9 @@ static inline void *leaklite_new(size_t size, std::align_val_t *align,
 //      log_error("ERROR - Leaklite memblock collision\n");
     }
     trailer->size = size;
+#ifdef LEAKLITE_THREADS
+    trailer->owner = leaklite_thread_alloc(size);
+#endif
 #ifndef NO_LAMBDA_LEAKLITE
     leaklite_alloc_tracker_t *tracker = get_tracker();
 #endif
@@ -80,6 +95,14 @@ static inline void *leaklite_new(size_t size, std::align_val_t *align,
 //    log_error("Alloc'ed mem, tracker is %p\n", tracker);
     ck_pr_inc_64(&tracker->active_allocs);
     ck_pr_add_64(&tracker->active_memsize, size);
+#ifdef LEAKLITE_JEMALLOC
+    trailer->usable = nallocx(size + sizeof(leaklite_trailer_t), flags);
+    ck_pr_add_64(&tracker->active_usable, trailer->usable);
+#endif
+#ifdef LEAKLITE_RESIDENT
+    trailer->resident = size >= LEAKLITE_RESIDENT_MIN ? leaklite_resident_add(ret, size, tracker)
+                                                      : NULL;
+#endif
     if (!tracker->was_linked) {
       pthread_mutex_lock(&tracker_head_mutex);
       tracker->type = type;
@@ -87,10 +110,15 @@ static inline void *leaklite_new(size_t size, std::align_val_t *align,
       tracker->fname = fname;
 #endif
       tracker->next = tracker_head;
+      // the history sampler walks the list without this mutex
+      ck_pr_fence_store();
       tracker_head = tracker;
       tracker->was_linked = true;
       pthread_mutex_unlock(&tracker_head_mutex);
     }
+#ifdef LEAKLITE_TRACE
+    leaklite_trace_alloc(tracker, ret, size);
+#endif
   }
   return ret;
 }
@@ -126,13 +154,35 @@ static inline void leaklite_delete(void *ptr, const char *fname, const char *src
           ck_pr_dec_64(&tracker->active_allocs);
           ck_pr_sub_64(&tracker->active_memsize, size);
           ck_pr_inc_64(&tracker->num_frees);
+#ifdef LEAKLITE_THREADS
+          if (leaklite_thread_free((*trailer)->owner, size)) {
+            ck_pr_inc_64(&tracker->xthread_frees);
+          }
+#endif
+#ifdef LEAKLITE_TRACE
+          leaklite_trace_free(tracker, ptr, size);
+#endif
+#ifdef LEAKLITE_JEMALLOC
+          uint64_t usable = (*trailer)->usable;
+          ck_pr_sub_64(&tracker->active_usable, usable);
+#endif
+#ifdef LEAKLITE_RESIDENT
+          if ((*trailer)->resident) {
+            leaklite_resident_remove((*trailer)->resident);
+          }
+#endif
           (*trailer)->tracker = NULL;
+#ifdef LEAKLITE_JEMALLOC
+          pointer_hash_remove(ptr);
+          sdallocx(ptr, usable, leaklite_mallocx_flags());
+          return;
+#endif
         }
         pointer_hash_remove(ptr);
       }
     }
     // will this work for arrays too?
-    free(ptr);
+    leaklite_real_free(ptr);
   }
 }
 
@@ -145,7 +195,9 @@ void *operator new[](size_t size, const char *fname, leaklite_alloc_tracker_t *t
 void *operator new[](size_t size, std::align_val_t al, const char *fname,
                      leaklite_alloc_tracker_t *tracker);
 
+#ifndef LEAKLITE_SOURCE_LOCATION
 #define new new(__FUNCTION__, &CONCAT(leaklite_alloc_tracker,__LINE__))
+#endif
 #else
 void *operator new(size_t size, const char *fname, leaklite_alloc_tracker_t *(*get_tracker)());
 void *operator new(size_t size, std::align_val_t al, const char *fname,
@@ -171,6 +223,151 @@ void operator delete(void *ptr, const char *fname, const char *srcfile, uint32_t
 void operator delete[](void *ptr, const char *fname, const char *srcfile, uint32_t linenum) noexcept;
 void operator delete(void *ptr) noexcept;
 void operator delete[](void *ptr) noexcept;
+#if defined(__cpp_aligned_new)
+// the sized and aligned forms end up here, and must not hand a tracked block to the C library
+void operator delete(void *ptr, std::align_val_t al) noexcept;
+void operator delete[](void *ptr, std::align_val_t al) noexcept;
+#endif
+
+#endif
+
+#ifdef LEAKLITE_SOURCE_LOCATION
+// C++20 mode that leaves malloc, calloc, free and new alone.  Call sites opt in explicitly:
+//
+//   char *buf = (char *)leaklite::malloc(size);
+//   leaklite::free(buf);
+//   Foo *foo = new (leaklite::here()) Foo(args);
+//   delete foo;
+//
+// std::source_location cannot be a template argument, so each call site gets its own tracker
+// through the unique closure type of the defaulted Tag parameter instead.  The tracker is a
+// constant-initialized static, and the source_location default argument only names it the
+// first time the site allocates.
+#include <source_location>
+
+namespace leaklite {
+
+template <typename Tag>
+struct site_tracker {
+  static constinit inline leaklite_alloc_tracker_t tracker =
+    {NULL, NULL, 0, NOT_SET, 0, 0, 0, false, NULL};
+};
+
+typedef struct {
+  leaklite_alloc_tracker_t *tracker;
+  std::source_location loc;
+} site_t;
+
+#ifdef DISABLE_LEAKLITE
+template <typename Tag = decltype([] {})>
+static inline void *malloc(size_t size,
+                           std::source_location loc = std::source_location::current())
+{
+  return ::malloc(size);
+}
+
+template <typename Tag = decltype([] {})>
+static inline void *calloc(size_t count, size_t size,
+                           std::source_location loc = std::source_location::current())
+{
+  return ::calloc(count, size);
+}
+
+static inline void free(void *ptr, std::source_location loc = std::source_location::current())
+{
+  ::free(ptr);
+}
+
+template <typename Tag = decltype([] {})>
+static inline site_t here(std::source_location loc = std::source_location::current())
+{
+  return {NULL, loc};
+}
+#else
+static inline leaklite_alloc_tracker_t *name_site(leaklite_alloc_tracker_t *tracker,
+                                                  const std::source_location &loc)
+{
+  if (!tracker->was_linked) {
+    pthread_mutex_lock(&tracker_head_mutex);
+    if (!tracker->srcfile) {
+      tracker->fname = loc.function_name();
+      tracker->srcfile = loc.file_name();
+      tracker->linenum = loc.line();
+    }
+    pthread_mutex_unlock(&tracker_head_mutex);
+  }
+  return tracker;
+}
 
+template <typename Tag = decltype([] {})>
+static inline void *malloc(size_t size,
+                           std::source_location loc = std::source_location::current())
+{
+  return leaklite_malloc(size, NULL, name_site(&site_tracker<Tag>::tracker, loc));
+}
+
+template <typename Tag = decltype([] {})>
+static inline void *calloc(size_t count, size_t size,
+                           std::source_location loc = std::source_location::current())
+{
+  return leaklite_calloc(count, size, NULL, name_site(&site_tracker<Tag>::tracker, loc));
+}
+
+static inline void free(void *ptr, std::source_location loc = std::source_location::current())
+{
+  leaklite_free(ptr, loc.function_name(), loc.file_name(), loc.line());
+}
+
+template <typename Tag = decltype([] {})>
+static inline site_t here(std::source_location loc = std::source_location::current())
+{
+  return {&site_tracker<Tag>::tracker, loc};
+}
+#endif
+
+}
+
+#ifdef DISABLE_LEAKLITE
+inline void *operator new(size_t size, leaklite::site_t site)
+{
+  return ::operator new(size);
+}
+
+inline void *operator new[](size_t size, leaklite::site_t site)
+{
+  return ::operator new[](size);
+}
+
+inline void operator delete(void *ptr, leaklite::site_t site) noexcept
+{
+  ::operator delete(ptr);
+}
+
+inline void operator delete[](void *ptr, leaklite::site_t site) noexcept
+{
+  ::operator delete[](ptr);
+}
+#else
+inline void *operator new(size_t size, leaklite::site_t site)
+{
+  return leaklite_new(size, NULL, leaklite::name_site(site.tracker, site.loc), NEW);
+}
+
+inline void *operator new[](size_t size, leaklite::site_t site)
+{
+  return leaklite_new(size, NULL, leaklite::name_site(site.tracker, site.loc), NEW_ARR);
+}
+
+// only called when a constructor throws out of a new (leaklite::here()) expression
+inline void operator delete(void *ptr, leaklite::site_t site) noexcept
+{
+  leaklite_delete(ptr, site.loc.function_name(), site.loc.file_name(), site.loc.line(), NEW);
+}
+
+inline void operator delete[](void *ptr, leaklite::site_t site) noexcept
+{
+  leaklite_delete(ptr, site.loc.function_name(), site.loc.file_name(), site.loc.line(), NEW_ARR);
+}
+#endif
 #endif
 #endif
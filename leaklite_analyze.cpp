@@ -0,0 +1,504 @@
+/*
+ * Copyright (c) 2020, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *    * Neither the name Circonus, Inc. nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Offline analyzer for trace files written by leaklite_trace.c.  This is a standalone tool and
+// must not be built with leaklite instrumentation.
+//
+//   leaklite_analyze [-b buckets] [-s slab_bytes] [-p site]... trace_file
+//
+// Reports the live heap over time, per-site churn, and the footprint of a simulated slab
+// allocator.  Each -p moves that site into a slab pool of its own, so the footprint with and
+// without a dedicated pool can be compared.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "util/leaklite_trace.h"
+
+#define PAGE_SIZE_SIM 4096
+
+static const char *type_str[] = {"not set", "malloc", "calloc", "new", "new[]",
+                                 "al new", "al new[]", "realloc"};
+
+typedef struct {
+  uint64_t ts;
+  uint64_t ptr;
+  uint64_t size;
+  uint32_t site;
+  uint32_t thread;
+  uint8_t kind;
+} event_t;
+
+typedef struct {
+  std::string fname;
+  std::string srcfile;
+  uint32_t linenum = 0;
+  uint8_t type = 0;
+  uint64_t allocs = 0;
+  uint64_t frees = 0;
+  uint64_t xthread_frees = 0;
+  uint64_t bytes_allocated = 0;
+  uint64_t live_bytes = 0;
+  uint64_t peak_live_bytes = 0;
+  uint64_t lifetime_ns = 0;
+} site_t;
+
+typedef struct {
+  uint64_t last_ptr = 0;
+  uint64_t last_ts = 0;
+} chain_t;
+
+static bool get_varint(const uint8_t **pos, const uint8_t *end, uint64_t *value)
+{
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64 && *pos < end; shift += 7) {
+    uint8_t byte = *(*pos)++;
+    result |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool get_string(const uint8_t **pos, const uint8_t *end, std::string *str)
+{
+  uint64_t len;
+  if (!get_varint(pos, end, &len) || (uint64_t)(end - *pos) < len) {
+    return false;
+  }
+  str->assign((const char *)*pos, len);
+  *pos += len;
+  return true;
+}
+
+static bool parse_chunk(const uint8_t *pos, const uint8_t *end, uint32_t thread, chain_t *chain,
+                        std::vector<event_t> *events, std::map<uint32_t, site_t> *sites)
+{
+  while (pos < end) {
+    uint8_t kind = *pos++;
+    uint64_t site, size, ptr_zz, ts_delta;
+    if (kind == LEAKLITE_TRACE_SITE) {
+      uint64_t linenum;
+      site_t info;
+      if (!get_varint(&pos, end, &site) || pos >= end) return false;
+      info.type = *pos++;
+      if (!get_string(&pos, end, &info.fname) || !get_string(&pos, end, &info.srcfile) ||
+          !get_varint(&pos, end, &linenum)) {
+        return false;
+      }
+      info.linenum = (uint32_t)linenum;
+      site_t &entry = (*sites)[(uint32_t)site];
+      entry.fname = info.fname;
+      entry.srcfile = info.srcfile;
+      entry.linenum = info.linenum;
+      entry.type = info.type;
+      continue;
+    }
+    if (kind != LEAKLITE_TRACE_ALLOC && kind != LEAKLITE_TRACE_FREE) return false;
+    if (!get_varint(&pos, end, &site) || !get_varint(&pos, end, &size) ||
+        !get_varint(&pos, end, &ptr_zz) || !get_varint(&pos, end, &ts_delta)) {
+      return false;
+    }
+    int64_t ptr_delta = (int64_t)(ptr_zz >> 1) ^ -(int64_t)(ptr_zz & 1);
+    chain->last_ptr += (uint64_t)ptr_delta;
+    chain->last_ts += ts_delta;
+    event_t event = {chain->last_ts, chain->last_ptr, size, (uint32_t)site, thread, kind};
+    events->push_back(event);
+    (*sites)[(uint32_t)site];
+  }
+  return true;
+}
+
+static bool read_trace(const char *path, std::vector<event_t> *events,
+                       std::map<uint32_t, site_t> *sites)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+  std::vector<uint8_t> data;
+  uint8_t block[65536];
+  size_t got;
+  while ((got = fread(block, 1, sizeof(block), file)) > 0) {
+    data.insert(data.end(), block, block + got);
+  }
+  fclose(file);
+
+  size_t magic_len = strlen(LEAKLITE_TRACE_MAGIC);
+  if (data.size() < magic_len || memcmp(data.data(), LEAKLITE_TRACE_MAGIC, magic_len) != 0) {
+    fprintf(stderr, "%s is not a leaklite trace\n", path);
+    return false;
+  }
+  std::unordered_map<uint64_t, chain_t> chains;
+  const uint8_t *pos = data.data() + magic_len;
+  const uint8_t *end = data.data() + data.size();
+  while (pos < end) {
+    uint64_t buffer, thread, len;
+    if (!get_varint(&pos, end, &buffer) || !get_varint(&pos, end, &thread) ||
+        !get_varint(&pos, end, &len) || (uint64_t)(end - pos) < len) {
+      // a trace cut off by a crash still has every complete chunk before this point
+      fprintf(stderr, "warning: truncated chunk at offset %zu, ignoring the rest\n",
+              (size_t)(pos - data.data()));
+      break;
+    }
+    if (!parse_chunk(pos, pos + len, (uint32_t)thread, &chains[buffer], events, sites)) {
+      fprintf(stderr, "warning: malformed record in chunk at offset %zu\n",
+              (size_t)(pos - data.data()));
+    }
+    pos += len;
+  }
+  // chunks from different threads are flushed independently, so put them back in time order
+  std::stable_sort(events->begin(), events->end(),
+                   [](const event_t &a, const event_t &b) { return a.ts < b.ts; });
+  return true;
+}
+
+// jemalloc style small size classes: 8, then four classes per doubling up to 14336
+static std::vector<uint64_t> make_size_classes()
+{
+  std::vector<uint64_t> classes = {8, 16, 32, 48, 64, 80, 96, 112, 128};
+  for (uint64_t group = 128; group < 16384; group *= 2) {
+    for (uint64_t step = 1; step <= 4; step++) {
+      uint64_t size = group + step * group / 4;
+      if (size >= 16384) break;
+      classes.push_back(size);
+    }
+  }
+  return classes;
+}
+
+typedef struct {
+  uint32_t used;
+  std::vector<uint32_t> free_slots;
+} slab_t;
+
+typedef struct {
+  uint64_t slot_size;
+  uint32_t slots_per_slab;
+  std::vector<slab_t> slabs;
+  std::set<uint32_t> nonfull;
+  std::vector<uint32_t> released;
+} size_class_t;
+
+typedef struct {
+  std::vector<size_class_t> classes;
+  uint64_t slab_bytes = 0;
+  uint64_t large_bytes = 0;
+  uint64_t requested = 0;
+  uint64_t peak_footprint = 0;
+  uint64_t peak_requested = 0;
+  uint64_t footprint() const { return slab_bytes + large_bytes; }
+} pool_t;
+
+typedef struct {
+  uint32_t pool;
+  int32_t size_class;
+  uint32_t slab;
+  uint32_t slot;
+} placement_t;
+
+class slab_sim {
+public:
+  slab_sim(uint64_t slab_size, size_t num_pools)
+    : slab_size_(slab_size), sizes_(make_size_classes()), pools_(num_pools)
+  {
+    for (pool_t &pool : pools_) {
+      for (uint64_t size : sizes_) {
+        size_class_t sc;
+        sc.slot_size = size;
+        sc.slots_per_slab = (uint32_t)std::max<uint64_t>(1, slab_size_ / size);
+        pool.classes.push_back(sc);
+      }
+    }
+  }
+
+  placement_t alloc(uint32_t pool_index, uint64_t size)
+  {
+    pool_t &pool = pools_[pool_index];
+    placement_t where = {pool_index, -1, 0, 0};
+    pool.requested += size;
+    auto it = std::lower_bound(sizes_.begin(), sizes_.end(), size);
+    if (it == sizes_.end()) {
+      pool.large_bytes += round_large(size);
+    }
+    else {
+      where.size_class = (int32_t)(it - sizes_.begin());
+      size_class_t &sc = pool.classes[where.size_class];
+      // lowest address slab with room first, like most slab allocators
+      if (sc.nonfull.empty()) {
+        uint32_t index;
+        if (!sc.released.empty()) {
+          index = sc.released.back();
+          sc.released.pop_back();
+        }
+        else {
+          index = (uint32_t)sc.slabs.size();
+          sc.slabs.push_back(slab_t());
+        }
+        slab_t &fresh = sc.slabs[index];
+        fresh.used = 0;
+        fresh.free_slots.clear();
+        for (uint32_t slot = sc.slots_per_slab; slot > 0; slot--) {
+          fresh.free_slots.push_back(slot - 1);
+        }
+        sc.nonfull.insert(index);
+        pool.slab_bytes += slab_size_;
+      }
+      where.slab = *sc.nonfull.begin();
+      slab_t &slab = sc.slabs[where.slab];
+      where.slot = slab.free_slots.back();
+      slab.free_slots.pop_back();
+      slab.used++;
+      if (slab.free_slots.empty()) {
+        sc.nonfull.erase(where.slab);
+      }
+    }
+    pool.peak_footprint = std::max(pool.peak_footprint, pool.footprint());
+    pool.peak_requested = std::max(pool.peak_requested, pool.requested);
+    return where;
+  }
+
+  void free(const placement_t &where, uint64_t size)
+  {
+    pool_t &pool = pools_[where.pool];
+    pool.requested -= size;
+    if (where.size_class < 0) {
+      pool.large_bytes -= round_large(size);
+      return;
+    }
+    size_class_t &sc = pool.classes[where.size_class];
+    slab_t &slab = sc.slabs[where.slab];
+    slab.free_slots.push_back(where.slot);
+    slab.used--;
+    if (slab.used == 0) {
+      // an empty slab goes back to the system
+      sc.nonfull.erase(where.slab);
+      sc.released.push_back(where.slab);
+      pool.slab_bytes -= slab_size_;
+    }
+    else {
+      sc.nonfull.insert(where.slab);
+    }
+  }
+
+  const pool_t &pool(size_t index) const { return pools_[index]; }
+
+private:
+  static uint64_t round_large(uint64_t size)
+  {
+    return (size + PAGE_SIZE_SIM - 1) / PAGE_SIZE_SIM * PAGE_SIZE_SIM;
+  }
+
+  uint64_t slab_size_;
+  std::vector<uint64_t> sizes_;
+  std::vector<pool_t> pools_;
+};
+
+typedef struct {
+  uint64_t size;
+  uint64_t ts;
+  uint32_t site;
+  uint32_t thread;
+  placement_t where;
+} live_block_t;
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-b buckets] [-s slab_bytes] [-p site]... trace_file\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t num_buckets = 40;
+  uint64_t slab_size = 65536;
+  std::vector<uint32_t> pooled_sites;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:s:p:h")) != -1) {
+    switch (opt) {
+      case 'b': num_buckets = (uint32_t)strtoul(optarg, NULL, 10); break;
+      case 's': slab_size = strtoull(optarg, NULL, 10); break;
+      case 'p': pooled_sites.push_back((uint32_t)strtoul(optarg, NULL, 10)); break;
+      default: usage(argv[0]); return 2;
+    }
+  }
+  if (optind != argc - 1 || num_buckets == 0 || slab_size == 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<event_t> events;
+  std::map<uint32_t, site_t> sites;
+  if (!read_trace(argv[optind], &events, &sites)) {
+    return 1;
+  }
+  if (events.empty()) {
+    printf("no alloc/free events in %s\n", argv[optind]);
+    return 0;
+  }
+
+  // pool 0 is shared, each -p site gets the next one
+  std::unordered_map<uint32_t, uint32_t> site_pool;
+  for (size_t i = 0; i < pooled_sites.size(); i++) {
+    site_pool[pooled_sites[i]] = (uint32_t)(i + 1);
+  }
+  slab_sim sim(slab_size, pooled_sites.size() + 1);
+
+  uint64_t start = events.front().ts;
+  uint64_t duration = events.back().ts - start;
+  uint64_t bucket_ns = duration / num_buckets + 1;
+  std::vector<uint64_t> bucket_end(num_buckets, 0), bucket_peak(num_buckets, 0);
+  std::vector<uint64_t> bucket_blocks(num_buckets, 0);
+  std::unordered_map<uint64_t, live_block_t> live;
+  std::set<uint32_t> threads;
+  uint64_t live_bytes = 0, peak_bytes = 0, peak_ts = 0, peak_blocks = 0;
+  uint64_t untraced_frees = 0;
+
+  for (const event_t &event : events) {
+    site_t &site = sites[event.site];
+    threads.insert(event.thread);
+    if (event.kind == LEAKLITE_TRACE_ALLOC) {
+      uint32_t pool = site_pool.count(event.site) ? site_pool[event.site] : 0;
+      live_block_t block = {event.size, event.ts, event.site, event.thread,
+                            sim.alloc(pool, event.size)};
+      auto prior = live.find(event.ptr);
+      if (prior != live.end()) {
+        // a free was dropped from the trace; retire the stale block so the totals stay sane
+        live_bytes -= prior->second.size;
+        sites[prior->second.site].live_bytes -= prior->second.size;
+        sim.free(prior->second.where, prior->second.size);
+        live.erase(prior);
+      }
+      live[event.ptr] = block;
+      live_bytes += event.size;
+      site.allocs++;
+      site.bytes_allocated += event.size;
+      site.live_bytes += event.size;
+      site.peak_live_bytes = std::max(site.peak_live_bytes, site.live_bytes);
+      if (live_bytes > peak_bytes) {
+        peak_bytes = live_bytes;
+        peak_ts = event.ts;
+      }
+      peak_blocks = std::max<uint64_t>(peak_blocks, live.size());
+    }
+    else {
+      auto it = live.find(event.ptr);
+      if (it == live.end()) {
+        // allocated before the trace started
+        untraced_frees++;
+        site.frees++;
+        continue;
+      }
+      const live_block_t &block = it->second;
+      live_bytes -= block.size;
+      site_t &alloc_site = sites[block.site];
+      alloc_site.live_bytes -= block.size;
+      alloc_site.frees++;
+      alloc_site.lifetime_ns += event.ts - block.ts;
+      if (block.thread != event.thread) {
+        alloc_site.xthread_frees++;
+      }
+      sim.free(block.where, block.size);
+      live.erase(it);
+    }
+    uint32_t bucket = (uint32_t)((event.ts - start) / bucket_ns);
+    bucket_end[bucket] = live_bytes;
+    bucket_peak[bucket] = std::max(bucket_peak[bucket], live_bytes);
+    bucket_blocks[bucket] = live.size();
+  }
+
+  printf("%zu events over %.3f s, %zu sites, %zu threads, %" PRIu64
+         " frees of blocks allocated before the trace\n",
+         events.size(), duration / 1e9, sites.size(), threads.size(), untraced_frees);
+  printf("peak live: %" PRIu64 " bytes at +%.3f s, %" PRIu64 " blocks at most\n\n", peak_bytes,
+         (peak_ts - start) / 1e9, peak_blocks);
+
+  printf("LIVE HEAP\n%10s %14s %14s %10s\n", "time (s)", "live bytes", "bucket peak", "blocks");
+  uint64_t carry = 0, carry_blocks = 0;
+  for (uint32_t i = 0; i < num_buckets; i++) {
+    // a bucket with no events keeps the previous value
+    if (bucket_peak[i]) {
+      carry = bucket_end[i];
+      carry_blocks = bucket_blocks[i];
+    }
+    printf("%10.3f %14" PRIu64 " %14" PRIu64 " %10" PRIu64 "\n",
+           (double)(i + 1) * bucket_ns / 1e9, carry, std::max(bucket_peak[i], carry),
+           carry_blocks);
+  }
+
+  std::vector<std::pair<uint32_t, const site_t *>> by_churn;
+  for (const auto &entry : sites) {
+    by_churn.push_back(std::make_pair(entry.first, &entry.second));
+  }
+  std::sort(by_churn.begin(), by_churn.end(), [](const auto &a, const auto &b) {
+    return a.second->allocs > b.second->allocs;
+  });
+  double seconds = duration > 0 ? duration / 1e9 : 1;
+  printf("\nSITE CHURN\n%6s %12s %12s %12s %14s %14s %14s %12s %10s  %s\n", "site", "allocs",
+         "frees", "allocs/s", "bytes alloced", "live bytes", "peak live", "lifetime ms",
+         "xthread", "location");
+  for (const auto &entry : by_churn) {
+    const site_t &site = *entry.second;
+    printf("%6u %12" PRIu64 " %12" PRIu64 " %12.0f %14" PRIu64 " %14" PRIu64 " %14" PRIu64
+           " %12.3f %10" PRIu64 "  %s %s %s:%u\n",
+           entry.first, site.allocs, site.frees, site.allocs / seconds, site.bytes_allocated,
+           site.live_bytes, site.peak_live_bytes,
+           site.frees ? site.lifetime_ns / 1e6 / site.frees : 0.0, site.xthread_frees,
+           site.type < sizeof(type_str) / sizeof(type_str[0]) ? type_str[site.type] : "?",
+           site.fname.empty() ? "?" : site.fname.c_str(), site.srcfile.c_str(), site.linenum);
+  }
+
+  printf("\nSLAB SIMULATION (%" PRIu64 " byte slabs, %d byte pages above %d bytes)\n", slab_size,
+         PAGE_SIZE_SIM, 14336);
+  printf("%10s %16s %16s %10s %16s\n", "pool", "peak footprint", "peak requested", "overhead",
+         "end footprint");
+  for (size_t i = 0; i <= pooled_sites.size(); i++) {
+    const pool_t &pool = sim.pool(i);
+    char name[32];
+    if (i == 0) snprintf(name, sizeof(name), "shared");
+    else snprintf(name, sizeof(name), "site %u", pooled_sites[i - 1]);
+    printf("%10s %16" PRIu64 " %16" PRIu64 " %9.1f%% %16" PRIu64 "\n", name,
+           pool.peak_footprint, pool.peak_requested,
+           pool.peak_requested
+             ? 100.0 * ((double)pool.peak_footprint / pool.peak_requested - 1.0) : 0.0,
+           pool.footprint());
+  }
+  return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2020, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *    * Neither the name Circonus, Inc. nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Standalone timing harness for the leaklite hot paths.  Build it once per capture mode against
+// the same leaklite sources and compare the ns/op figures, see BUILD.md.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include "util/leaklite.hpp"
+
+#ifdef LEAKLITE_SOURCE_LOCATION
+#define BENCH_MODE "source_location"
+#define BENCH_MALLOC(size) leaklite::malloc(size)
+#define BENCH_FREE(ptr) leaklite::free(ptr)
+#define BENCH_NEW(type) new (leaklite::here()) type
+#elif defined(LEAKLITE_WRAP)
+// plain calls, the linker routes malloc and free through leaklite_wrap.c
+#undef malloc
+#undef free
+#undef new
+#undef __LEAKLITE__
+#define __LEAKLITE__
+#define BENCH_MODE "wrap"
+#define BENCH_MALLOC(size) malloc(size)
+#define BENCH_FREE(ptr) free(ptr)
+#define BENCH_NEW(type) new type
+#elif defined(NO_LAMBDA_LEAKLITE)
+#define BENCH_MODE "no lambda"
+#define BENCH_MALLOC(size) malloc(size)
+#define BENCH_FREE(ptr) free(ptr)
+#define BENCH_NEW(type) new type
+#else
+#define BENCH_MODE "lambda"
+#define BENCH_MALLOC(size) malloc(size)
+#define BENCH_FREE(ptr) free(ptr)
+#define BENCH_NEW(type) new type
+#endif
+
+#define BENCH_BATCH 64
+
+typedef struct {
+  uint64_t a, b, c, d;
+} bench_obj_t;
+
+// CPU time of the calling thread, so background work such as the trace flusher is not charged
+// to the allocation path on a busy or single core machine
+static uint64_t bench_now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+// Allocations are made in batches so the allocator cannot hand the same block straight back,
+// which would flatter the pointer hash.
+static double bench_malloc_free(uint64_t iterations)
+{
+  void *ptrs[BENCH_BATCH];
+  uint64_t start = bench_now_ns();
+  for (uint64_t i = 0; i < iterations; i += BENCH_BATCH) {
+    for (int j = 0; j < BENCH_BATCH; j++) {
+      __LEAKLITE__ ptrs[j] = BENCH_MALLOC(64);
+    }
+    for (int j = 0; j < BENCH_BATCH; j++) {
+      BENCH_FREE(ptrs[j]);
+    }
+  }
+  return (double)(bench_now_ns() - start) / (double)iterations;
+}
+
+static double bench_new_delete(uint64_t iterations)
+{
+  bench_obj_t *objs[BENCH_BATCH];
+  uint64_t start = bench_now_ns();
+  for (uint64_t i = 0; i < iterations; i += BENCH_BATCH) {
+    for (int j = 0; j < BENCH_BATCH; j++) {
+      __LEAKLITE__ objs[j] = BENCH_NEW(bench_obj_t);
+    }
+    for (int j = 0; j < BENCH_BATCH; j++) {
+      delete objs[j];
+    }
+  }
+  return (double)(bench_now_ns() - start) / (double)iterations;
+}
+
+int main(int argc, char **argv)
+{
+  uint64_t iterations = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+  pointer_hash_init();
+#ifdef LEAKLITE_TRACE
+  const char *trace_path = argc > 2 ? argv[2] : "leaklite_bench.trace";
+  if (!leaklite_trace_start(trace_path)) {
+    fprintf(stderr, "cannot trace to %s\n", trace_path);
+    return 1;
+  }
+#endif
+  // warm the pointer hash and both sites before timing
+  bench_malloc_free(BENCH_BATCH * 16);
+  bench_new_delete(BENCH_BATCH * 16);
+  printf("mode: %s, %" PRIu64 " iterations\n", BENCH_MODE, iterations);
+  printf("malloc/free pair: %8.2f ns/op\n", bench_malloc_free(iterations));
+  printf("new/delete pair:  %8.2f ns/op\n", bench_new_delete(iterations));
+#ifdef LEAKLITE_TRACE
+  leaklite_trace_stop();
+  printf("traced to %s, %" PRIu64 " events dropped\n", trace_path, leaklite_trace_dropped());
+#endif
+  leaklite_dump();
+  return 0;
+}
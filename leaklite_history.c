@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2020, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *    * Neither the name Circonus, Inc. nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include "util/leaklite.h"
+#include "util/leaklite_history.h"
+
+// the sampler's own bookkeeping must never be counted by leaklite itself
+#undef malloc
+#undef calloc
+#undef free
+
+#if LEAKLITE_HISTORY_SAMPLES < 3
+#error "LEAKLITE_HISTORY_SAMPLES must be at least 3 to fit a slope"
+#endif
+
+// Sample k lives in slot k % LEAKLITE_HISTORY_SAMPLES.  Each slot holds, per site, the change in
+// active_memsize since the previous sample, so a site's series over the window is rebuilt by
+// summing deltas forward from the oldest sample.  Deltas are stored as int32_t; a larger swing
+// is clamped and the remainder carries into the next sample through recorded[], so the rebuilt
+// series never drifts from the real counter.
+static int32_t *deltas = NULL;
+static uint64_t stamps[LEAKLITE_HISTORY_SAMPLES];
+static leaklite_alloc_tracker_t *sites[LEAKLITE_HISTORY_MAX_SITES];
+static uint64_t recorded[LEAKLITE_HISTORY_MAX_SITES];
+static uint64_t first_seq[LEAKLITE_HISTORY_MAX_SITES];
+static uint32_t num_sites = 0;
+static leaklite_alloc_tracker_t *seen_head = NULL;
+static uint64_t seq = 0;
+
+// Only the sampler and readers of the history take this lock; allocating threads never do.
+static pthread_mutex_t history_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t history_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t sampler_thread;
+static bool running = false;
+static uint32_t interval = 0;
+
+static inline int32_t *history_slot(uint64_t sample)
+{
+  return deltas + (sample % LEAKLITE_HISTORY_SAMPLES) * LEAKLITE_HISTORY_MAX_SITES;
+}
+
+static uint64_t history_now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// Trackers are only ever pushed onto the front of the list, so everything between the current
+// head and the head seen on the previous pass is new.  Sites past LEAKLITE_HISTORY_MAX_SITES
+// are not recorded.
+static void history_discover_sites(uint64_t s)
+{
+  leaklite_alloc_tracker_t *head = (leaklite_alloc_tracker_t *)ck_pr_load_ptr(&tracker_head);
+  leaklite_alloc_tracker_t *curr = head;
+  while (curr && curr != seen_head && num_sites < LEAKLITE_HISTORY_MAX_SITES) {
+    uint64_t value = ck_pr_load_64(&curr->active_memsize);
+    sites[num_sites] = curr;
+    recorded[num_sites] = value;
+    first_seq[num_sites] = s;
+    num_sites++;
+    curr = curr->next;
+  }
+  seen_head = head;
+}
+
+static void history_take_sample()
+{
+  uint64_t s = seq;
+  int32_t *row = history_slot(s);
+  uint32_t known = num_sites;
+  history_discover_sites(s);
+  for (uint32_t i = 0; i < known; i++) {
+    int64_t delta = (int64_t)(ck_pr_load_64(&sites[i]->active_memsize) - recorded[i]);
+    if (delta > INT32_MAX) delta = INT32_MAX;
+    else if (delta < INT32_MIN) delta = INT32_MIN;
+    recorded[i] += delta;
+    row[i] = (int32_t)delta;
+  }
+  for (uint32_t i = known; i < num_sites; i++) {
+    row[i] = 0;
+  }
+  stamps[s % LEAKLITE_HISTORY_SAMPLES] = history_now_ms();
+  seq = s + 1;
+}
+
+static void *history_sampler(void *arg)
+{
+  (void)arg;
+  pthread_mutex_lock(&history_mutex);
+  while (running) {
+    history_take_sample();
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += interval / 1000;
+    deadline.tv_nsec += (long)(interval % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    while (running && pthread_cond_timedwait(&history_cond, &history_mutex, &deadline) == 0);
+  }
+  pthread_mutex_unlock(&history_mutex);
+  return NULL;
+}
+
+bool leaklite_history_start(uint32_t interval_ms)
+{
+  if (interval_ms == 0) {
+    return false;
+  }
+  pthread_mutex_lock(&history_mutex);
+  if (running) {
+    pthread_mutex_unlock(&history_mutex);
+    return false;
+  }
+  if (!deltas) {
+    deltas = (int32_t *)leaklite_real_malloc(sizeof(int32_t) * LEAKLITE_HISTORY_SAMPLES *
+                                             LEAKLITE_HISTORY_MAX_SITES);
+    if (!deltas) {
+      pthread_mutex_unlock(&history_mutex);
+      return false;
+    }
+  }
+  // a restart begins a fresh window, the old one would have a gap in it
+  num_sites = 0;
+  seen_head = NULL;
+  seq = 0;
+  interval = interval_ms;
+  running = true;
+  if (pthread_create(&sampler_thread, NULL, history_sampler, NULL) != 0) {
+    running = false;
+    pthread_mutex_unlock(&history_mutex);
+    return false;
+  }
+  pthread_mutex_unlock(&history_mutex);
+  return true;
+}
+
+void leaklite_history_stop()
+{
+  pthread_mutex_lock(&history_mutex);
+  if (!running) {
+    pthread_mutex_unlock(&history_mutex);
+    return;
+  }
+  running = false;
+  pthread_cond_signal(&history_cond);
+  pthread_mutex_unlock(&history_mutex);
+  pthread_join(sampler_thread, NULL);
+}
+
+uint32_t leaklite_history_interval_ms()
+{
+  pthread_mutex_lock(&history_mutex);
+  uint32_t ret = running ? interval : 0;
+  pthread_mutex_unlock(&history_mutex);
+  return ret;
+}
+
+// steepest first
+static int history_steeper(const void *a, const void *b)
+{
+  double slope_a = ((const leaklite_history_growth_t *)a)->slope;
+  double slope_b = ((const leaklite_history_growth_t *)b)->slope;
+  return (slope_a < slope_b) - (slope_a > slope_b);
+}
+
+// Least squares fit of live bytes against time for every site with at least three samples in
+// the window.  Sites with a positive slope and an r^2 of at least min_confidence are returned
+// in out, steepest first, up to max_out of them.
+size_t leaklite_history_rank(leaklite_history_growth_t *out, size_t max_out,
+                             double min_confidence)
+{
+  size_t found = 0;
+  if (!out || max_out == 0) {
+    return 0;
+  }
+  pthread_mutex_lock(&history_mutex);
+  uint64_t window_start = seq > LEAKLITE_HISTORY_SAMPLES ? seq - LEAKLITE_HISTORY_SAMPLES : 0;
+  for (uint32_t i = 0; i < num_sites; i++) {
+    uint64_t oldest = first_seq[i] > window_start ? first_seq[i] : window_start;
+    if (seq < oldest + 3) {
+      continue;
+    }
+    uint32_t n = (uint32_t)(seq - oldest);
+    uint64_t t0 = stamps[oldest % LEAKLITE_HISTORY_SAMPLES];
+    // values are relative to the oldest sample to keep the sums well inside double precision
+    double sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0, sum_yy = 0;
+    int64_t y = 0;
+    for (uint64_t k = oldest; k < seq; k++) {
+      if (k > oldest) {
+        y += history_slot(k)[i];
+      }
+      double x = (double)(stamps[k % LEAKLITE_HISTORY_SAMPLES] - t0) / 1000.0;
+      sum_x += x;
+      sum_y += (double)y;
+      sum_xx += x * x;
+      sum_xy += x * (double)y;
+      sum_yy += (double)y * (double)y;
+    }
+    double sxx = sum_xx - sum_x * sum_x / n;
+    double sxy = sum_xy - sum_x * sum_y / n;
+    double syy = sum_yy - sum_y * sum_y / n;
+    if (sxx <= 0 || syy <= 0 || sxy <= 0) {
+      continue;
+    }
+    leaklite_history_growth_t growth;
+    growth.tracker = sites[i];
+    growth.slope = sxy / sxx;
+    growth.confidence = (sxy * sxy) / (sxx * syy);
+    growth.growth = y;
+    growth.samples = n;
+    if (growth.confidence < min_confidence) {
+      continue;
+    }
+    found = leaklite_rank_insert(out, found, max_out, sizeof(*out), &growth, history_steeper);
+  }
+  pthread_mutex_unlock(&history_mutex);
+  return found;
+}
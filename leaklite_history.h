@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2020, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *    * Neither the name Circonus, Inc. nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _UTILS_LEAKLITE_HISTORY_H
+#define _UTILS_LEAKLITE_HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The history ring is allocated once when the sampler starts and never grows, so its size is
+// LEAKLITE_HISTORY_SAMPLES * LEAKLITE_HISTORY_MAX_SITES * 4 bytes regardless of uptime.
+#ifndef LEAKLITE_HISTORY_SAMPLES
+#define LEAKLITE_HISTORY_SAMPLES 120
+#endif
+#ifndef LEAKLITE_HISTORY_MAX_SITES
+#define LEAKLITE_HISTORY_MAX_SITES 2048
+#endif
+
+struct leaklite_alloc_tracker;
+
+typedef struct {
+  struct leaklite_alloc_tracker *tracker;
+  double slope;        // live bytes per second, least squares over the window
+  double confidence;   // r^2 of the fit, 0.0 - 1.0
+  int64_t growth;      // live bytes gained between the first and last sample
+  uint32_t samples;
+} leaklite_history_growth_t;
+
+bool leaklite_history_start(uint32_t interval_ms);
+void leaklite_history_stop();
+uint32_t leaklite_history_interval_ms();
+size_t leaklite_history_rank(leaklite_history_growth_t *out, size_t max_out,
+                             double min_confidence);
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2020, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *    * Neither the name Circonus, Inc. nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "util/leaklite.h"
+
+#ifdef LEAKLITE_JEMALLOC_ARENA
+__thread int leaklite_jemalloc_thread_flags = 0;
+
+static unsigned arena = 0;
+static bool arena_created = false;
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;
+
+// Runs at thread exit, anything still in the thread's cache goes back to the arena.
+static void jemalloc_release_tcache(void *arg)
+{
+  unsigned tcache = (unsigned)((uintptr_t)arg - 1);
+  leaklite_jemalloc_thread_flags = 0;
+  mallctl("tcache.destroy", NULL, NULL, &tcache, sizeof(tcache));
+}
+
+static void jemalloc_create_arena()
+{
+  size_t len = sizeof(arena);
+  if (mallctl("arenas.create", &arena, &len, NULL, 0) == 0) {
+    arena_created = true;
+  }
+  pthread_key_create(&tcache_key, jemalloc_release_tcache);
+}
+
+// If the arena cannot be created, tracked blocks go to the default arenas and the setup is
+// retried on every call, which only costs the pthread_once check.
+int leaklite_jemalloc_thread_setup()
+{
+  pthread_once(&arena_once, jemalloc_create_arena);
+  if (!arena_created) {
+    return 0;
+  }
+  int flags = MALLOCX_ARENA(arena);
+  unsigned tcache;
+  size_t len = sizeof(tcache);
+  if (mallctl("tcache.create", &tcache, &len, NULL, 0) == 0) {
+    flags |= MALLOCX_TCACHE(tcache);
+    pthread_setspecific(tcache_key, (void *)((uintptr_t)tcache + 1));
+  }
+  else {
+    flags |= MALLOCX_TCACHE_NONE;
+  }
+  leaklite_jemalloc_thread_flags = flags;
+  return flags;
+}
+
+// jemalloc's own view of the dedicated arena, which includes the trailers and whatever sits in
+// the thread caches.  Needs jemalloc built with statistics, the default.
+bool leaklite_jemalloc_arena_stats(size_t *allocated, size_t *resident, size_t *mapped)
+{
+  pthread_once(&arena_once, jemalloc_create_arena);
+  if (!arena_created) {
+    return false;
+  }
+  uint64_t epoch = 1;
+  size_t len = sizeof(epoch);
+  mallctl("epoch", &epoch, &len, &epoch, len);
+  char name[64];
+  size_t small = 0, large = 0;
+  len = sizeof(size_t);
+  snprintf(name, sizeof(name), "stats.arenas.%u.small.allocated", arena);
+  if (mallctl(name, &small, &len, NULL, 0) != 0) {
+    return false;
+  }
+  snprintf(name, sizeof(name), "stats.arenas.%u.large.allocated", arena);
+  if (mallctl(name, &large, &len, NULL, 0) != 0) {
+    return false;
+  }
+  *allocated = small + large;
+  snprintf(name, sizeof(name), "stats.arenas.%u.resident", arena);
+  if (mallctl(name, resident, &len, NULL, 0) != 0) {
+    *resident = 0;
+  }
+  snprintf(name, sizeof(name), "stats.arenas.%u.mapped", arena);
+  if (mallctl(name, mapped, &len, NULL, 0) != 0) {
+    *mapped = 0;
+  }
+  return true;
+}
+#endif
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2020, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *    * Neither the name Circonus, Inc. nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _UTILS_LEAKLITE_JEMALLOC_H
+#define _UTILS_LEAKLITE_JEMALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <jemalloc/jemalloc.h>
+
+// With LEAKLITE_JEMALLOC, tracked blocks are allocated with mallocx and freed with sdallocx,
+// using the size class recorded in the trailer, so jemalloc never has to look the block up.
+//
+// Define LEAKLITE_JEMALLOC_ARENA as well to put them in an arena of their own.  jemalloc's
+// automatic thread cache is shared by all arenas, so each thread also gets an explicit cache
+// for that arena; without one, the arena would be mixed with blocks from the default arenas.
+
+#ifdef LEAKLITE_JEMALLOC_ARENA
+extern __thread int leaklite_jemalloc_thread_flags;
+
+int leaklite_jemalloc_thread_setup();
+bool leaklite_jemalloc_arena_stats(size_t *allocated, size_t *resident, size_t *mapped);
+#endif
+
+// MALLOCX_ARENA() is never 0, so 0 means this thread is not set up yet
+static inline int leaklite_mallocx_flags()
+{
+#ifdef LEAKLITE_JEMALLOC_ARENA
+  int flags = leaklite_jemalloc_thread_flags;
+  return flags ? flags : leaklite_jemalloc_thread_setup();
+#else
+  return 0;
+#endif
+}
+
+#endif
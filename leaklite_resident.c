@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2020, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *    * Neither the name Circonus, Inc. nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "util/leaklite.h"
+#include "util/leaklite_resident.h"
+
+#undef malloc
+#undef calloc
+#undef free
+
+// pages handed to one mincore call, the lock is dropped between calls
+#define RESIDENT_BATCH_PAGES 4096
+
+typedef struct leaklite_resident_block {
+  void *ptr;
+  uint64_t size;
+  leaklite_alloc_tracker_t *tracker;
+  uint64_t resident;     // last complete measurement, included in tracker->active_resident
+  uint64_t measuring;    // resident bytes found so far by the measurement in progress
+  struct leaklite_resident_block *prev;
+  struct leaklite_resident_block *next;
+} leaklite_resident_block_t;
+
+// Every registered block, newest first.  The scan resumes from cursor, cursor_offset pages into
+// its block, so a block larger than one call's budget is measured over several calls and its
+// figure only changes once the whole block has been seen.
+static leaklite_resident_block_t *blocks = NULL;
+static leaklite_resident_block_t *cursor = NULL;
+static uint64_t cursor_offset = 0;
+static uint64_t num_blocks = 0;
+static uint64_t num_bytes = 0;
+static uint64_t total_resident = 0;
+static uint64_t passes = 0;
+static pthread_mutex_t resident_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+leaklite_resident_block_t *leaklite_resident_add(void *ptr, uint64_t size,
+                                                 leaklite_alloc_tracker_t *tracker)
+{
+  leaklite_resident_block_t *block =
+    (leaklite_resident_block_t *)leaklite_real_malloc(sizeof(leaklite_resident_block_t));
+  if (!block) {
+    return NULL;
+  }
+  block->ptr = ptr;
+  block->size = size;
+  block->tracker = tracker;
+  block->resident = 0;
+  block->measuring = 0;
+  block->prev = NULL;
+  pthread_mutex_lock(&resident_mutex);
+  block->next = blocks;
+  if (blocks) {
+    blocks->prev = block;
+  }
+  blocks = block;
+  num_blocks++;
+  num_bytes += size;
+  pthread_mutex_unlock(&resident_mutex);
+  return block;
+}
+
+void leaklite_resident_remove(leaklite_resident_block_t *block)
+{
+  pthread_mutex_lock(&resident_mutex);
+  if (cursor == block) {
+    cursor = block->next;
+    cursor_offset = 0;
+    if (!cursor) {
+      passes++;
+    }
+  }
+  if (block->prev) {
+    block->prev->next = block->next;
+  }
+  else {
+    blocks = block->next;
+  }
+  if (block->next) {
+    block->next->prev = block->prev;
+  }
+  num_blocks--;
+  num_bytes -= block->size;
+  total_resident -= block->resident;
+  ck_pr_sub_64(&block->tracker->active_resident, block->resident);
+  pthread_mutex_unlock(&resident_mutex);
+  leaklite_real_free(block);
+}
+
+// Measures up to max_pages pages of registered blocks with mincore, carrying on from where the
+// previous call stopped, and stopping early the second time it reaches the end of the list.
+// Returns the number of pages measured.  Pages shared with a neighbouring allocation at either end of a block are
+// counted, so each block is clamped to its own size.
+uint64_t leaklite_resident_scan(uint64_t max_pages)
+{
+  uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+  unsigned char vec[RESIDENT_BATCH_PAGES];
+  uint64_t scanned = 0;
+  bool wrapped = false;
+  while (scanned < max_pages) {
+    pthread_mutex_lock(&resident_mutex);
+    if (!cursor) {
+      if (wrapped || !blocks) {
+        pthread_mutex_unlock(&resident_mutex);
+        break;
+      }
+      cursor = blocks;
+      cursor_offset = 0;
+      wrapped = true;
+    }
+    leaklite_resident_block_t *block = cursor;
+    uintptr_t start = (uintptr_t)block->ptr & ~(page_size - 1);
+    uintptr_t end = ((uintptr_t)block->ptr + block->size + page_size - 1) & ~(page_size - 1);
+    uint64_t pages = (end - start) / page_size;
+    uint64_t count = pages - cursor_offset;
+    if (count > RESIDENT_BATCH_PAGES) {
+      count = RESIDENT_BATCH_PAGES;
+    }
+    if (count > max_pages - scanned) {
+      count = max_pages - scanned;
+    }
+    if (mincore((void *)(start + cursor_offset * page_size), count * page_size, vec) == 0) {
+      uint64_t found = 0;
+      for (uint64_t i = 0; i < count; i++) {
+        found += vec[i] & 1;
+      }
+      block->measuring += found * page_size;
+    }
+    scanned += count;
+    cursor_offset += count;
+    if (cursor_offset >= pages) {
+      uint64_t measured = block->measuring < block->size ? block->measuring : block->size;
+      // unsigned wrap-around makes these work for shrinking blocks as well
+      total_resident += measured - block->resident;
+      ck_pr_add_64(&block->tracker->active_resident, measured - block->resident);
+      block->resident = measured;
+      block->measuring = 0;
+      cursor = block->next;
+      cursor_offset = 0;
+      if (!cursor) {
+        passes++;
+      }
+    }
+    pthread_mutex_unlock(&resident_mutex);
+  }
+  return scanned;
+}
+
+void leaklite_resident_stats(leaklite_resident_stats_t *stats)
+{
+  pthread_mutex_lock(&resident_mutex);
+  stats->blocks = num_blocks;
+  stats->bytes = num_bytes;
+  stats->resident = total_resident;
+  stats->passes = passes;
+  pthread_mutex_unlock(&resident_mutex);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2020, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *    * Neither the name Circonus, Inc. nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _UTILS_LEAKLITE_RESIDENT_H
+#define _UTILS_LEAKLITE_RESIDENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Blocks of at least LEAKLITE_RESIDENT_MIN requested bytes are registered when they are
+// allocated, and leaklite_resident_scan measures how much of them is actually in memory.  Only
+// those blocks count towards a tracker's active_resident.
+#ifndef LEAKLITE_RESIDENT_MIN
+#define LEAKLITE_RESIDENT_MIN (1 << 20)
+#endif
+// pages measured per leaklite_dump or REST dump, 1 GiB of 4 KiB pages
+#ifndef LEAKLITE_RESIDENT_SCAN_PAGES
+#define LEAKLITE_RESIDENT_SCAN_PAGES (1 << 18)
+#endif
+// most pages one REST dump may ask for with resident_pages
+#ifndef LEAKLITE_RESIDENT_SCAN_PAGES_MAX
+#define LEAKLITE_RESIDENT_SCAN_PAGES_MAX ((uint64_t)LEAKLITE_RESIDENT_SCAN_PAGES * 16)
+#endif
+
+struct leaklite_alloc_tracker;
+struct leaklite_resident_block;
+
+typedef struct {
+  uint64_t blocks;       // registered large blocks
+  uint64_t bytes;        // their requested bytes
+  uint64_t resident;     // resident bytes as of each block's last measurement
+  uint64_t passes;       // completed passes over every registered block
+} leaklite_resident_stats_t;
+
+struct leaklite_resident_block *leaklite_resident_add(void *ptr, uint64_t size,
+                                                      struct leaklite_alloc_tracker *tracker);
+void leaklite_resident_remove(struct leaklite_resident_block *block);
+uint64_t leaklite_resident_scan(uint64_t max_pages);
+void leaklite_resident_stats(leaklite_resident_stats_t *stats);
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2020, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *    * Neither the name Circonus, Inc. nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "util/leaklite.h"
+#include "util/leaklite_threads.h"
+
+// slot 0 is never claimed, its generation stays at 1
+leaklite_thread_slot_t leaklite_thread_slots[LEAKLITE_THREAD_SLOTS] = {{0, 0, 1, 1, 0}};
+__thread uint64_t leaklite_thread_owner = 0;
+
+static pthread_key_t slot_key;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+
+// Runs at thread exit.  The generation moves first, so frees from then on go to slot 0, and
+// what is still live is handed to slot 0 after.  A free that checked the generation before it
+// moved can still subtract from the slot after it was emptied, wrapping its counters below 0;
+// leaklite_thread_claim folds that remainder into slot 0 before the slot is reused.
+static void thread_release_slot(void *arg)
+{
+  leaklite_thread_slot_t *slot = (leaklite_thread_slot_t *)arg;
+  uint32_t generation = ck_pr_load_32(&slot->generation) + 1;
+  ck_pr_store_32(&slot->generation, generation ? generation : 1);
+  ck_pr_fence_store();
+  uint64_t bytes = ck_pr_fas_64(&slot->live_bytes, 0);
+  uint64_t blocks = ck_pr_fas_64(&slot->live_blocks, 0);
+  ck_pr_add_64(&leaklite_thread_slots[0].live_bytes, bytes);
+  ck_pr_add_64(&leaklite_thread_slots[0].live_blocks, blocks);
+  slot->tid = 0;
+  leaklite_thread_owner = 0;
+  ck_pr_fence_store();
+  ck_pr_store_32(&slot->in_use, 0);
+}
+
+static void thread_create_key()
+{
+  pthread_key_create(&slot_key, thread_release_slot);
+}
+
+uint64_t leaklite_thread_claim()
+{
+  for (uint32_t i = 1; i < LEAKLITE_THREAD_SLOTS; i++) {
+    leaklite_thread_slot_t *slot = &leaklite_thread_slots[i];
+    if (!ck_pr_load_32(&slot->in_use) && ck_pr_cas_32(&slot->in_use, 0, 1)) {
+      // whatever late frees left behind belongs with the rest of the old thread's blocks, the
+      // unsigned add moves a wrapped remainder back out of slot 0 as well
+      uint64_t bytes = ck_pr_fas_64(&slot->live_bytes, 0);
+      uint64_t blocks = ck_pr_fas_64(&slot->live_blocks, 0);
+      ck_pr_add_64(&leaklite_thread_slots[0].live_bytes, bytes);
+      ck_pr_add_64(&leaklite_thread_slots[0].live_blocks, blocks);
+      uint32_t generation = slot->generation + 1;
+      generation = generation ? generation : 1;
+      ck_pr_store_32(&slot->generation, generation);
+      slot->tid = (pid_t)syscall(SYS_gettid);
+      pthread_once(&slot_key_once, thread_create_key);
+      pthread_setspecific(slot_key, slot);
+      leaklite_thread_owner = (uint64_t)i << 32 | generation;
+      return leaklite_thread_owner;
+    }
+  }
+  leaklite_thread_owner = 1;
+  return leaklite_thread_owner;
+}
+
+static void thread_name(pid_t tid, char *name, size_t len)
+{
+  char path[64];
+  name[0] = '\0';
+  snprintf(path, sizeof(path), "/proc/self/task/%d/comm", (int)tid);
+  FILE *comm = fopen(path, "r");
+  if (comm) {
+    if (fgets(name, len, comm)) {
+      name[strcspn(name, "\n")] = '\0';
+    }
+    fclose(comm);
+  }
+}
+
+static int thread_more_bytes(const void *a, const void *b)
+{
+  uint64_t bytes_a = ((const leaklite_thread_usage_t *)a)->live_bytes;
+  uint64_t bytes_b = ((const leaklite_thread_usage_t *)b)->live_bytes;
+  return (bytes_a < bytes_b) - (bytes_a > bytes_b);
+}
+
+static int thread_more_xfree(const void *a, const void *b)
+{
+  double share_a = ((const leaklite_thread_xfree_t *)a)->share;
+  double share_b = ((const leaklite_thread_xfree_t *)b)->share;
+  return (share_a < share_b) - (share_a > share_b);
+}
+
+// Fills out with every slot that has a live thread or live bytes, most live bytes first.
+size_t leaklite_thread_usage(leaklite_thread_usage_t *out, size_t max_out)
+{
+  size_t found = 0;
+  for (uint32_t i = 0; i < LEAKLITE_THREAD_SLOTS; i++) {
+    leaklite_thread_slot_t *slot = &leaklite_thread_slots[i];
+    leaklite_thread_usage_t usage;
+    usage.slot = i;
+    usage.tid = i ? ck_pr_load_int(&slot->tid) : 0;
+    usage.live_bytes = ck_pr_load_64(&slot->live_bytes);
+    usage.live_blocks = ck_pr_load_64(&slot->live_blocks);
+    if (!usage.tid && !usage.live_blocks) {
+      continue;
+    }
+    if (usage.tid) {
+      thread_name(usage.tid, usage.name, sizeof(usage.name));
+    }
+    else {
+      strcpy(usage.name, i ? "(exiting)" : "(exited)");
+    }
+    found = leaklite_rank_insert(out, found, max_out, sizeof(*out), &usage, thread_more_bytes);
+  }
+  return found;
+}
+
+// Sites with at least min_frees frees, of which some were on another thread, ranked by the
+// share of their frees that were.
+size_t leaklite_thread_rank_xfree(leaklite_thread_xfree_t *out, size_t max_out,
+                                  uint64_t min_frees)
+{
+  size_t found = 0;
+  if (!out || max_out == 0) {
+    return 0;
+  }
+  leaklite_alloc_tracker_t *curr = (leaklite_alloc_tracker_t *)ck_pr_load_ptr(&tracker_head);
+  while (curr) {
+    uint64_t frees = ck_pr_load_64(&curr->num_frees);
+    uint64_t xthread = ck_pr_load_64(&curr->xthread_frees);
+    if (xthread && frees && frees >= min_frees) {
+      leaklite_thread_xfree_t xfree;
+      xfree.tracker = curr;
+      xfree.share = xthread > frees ? 1.0 : (double)xthread / (double)frees;
+      found = leaklite_rank_insert(out, found, max_out, sizeof(*out), &xfree, thread_more_xfree);
+    }
+    curr = curr->next;
+  }
+  return found;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2020, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *    * Neither the name Circonus, Inc. nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _UTILS_LEAKLITE_THREADS_H
+#define _UTILS_LEAKLITE_THREADS_H
+
+#include "ck_pr.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// A thread claims a slot the first time it allocates and gives it back when it exits.  Slot 0
+// holds the blocks left behind by exited threads, and is shared by any thread that finds every
+// other slot taken; frees between two such threads are not seen as cross-thread.
+#ifndef LEAKLITE_THREAD_SLOTS
+#define LEAKLITE_THREAD_SLOTS 256
+#endif
+
+// Each block records its owner as slot << 32 | generation.  A slot's generation moves on when
+// its thread exits, so the next thread to claim it never inherits the old thread's blocks.
+typedef struct {
+  uint64_t live_bytes;
+  uint64_t live_blocks;
+  uint32_t generation;
+  uint32_t in_use;
+  pid_t tid;
+} __attribute__((aligned(64))) leaklite_thread_slot_t;
+
+typedef struct {
+  uint32_t slot;
+  pid_t tid;           // 0 once the thread has exited
+  char name[16];
+  uint64_t live_bytes;
+  uint64_t live_blocks;
+} leaklite_thread_usage_t;
+
+struct leaklite_alloc_tracker;
+
+typedef struct {
+  struct leaklite_alloc_tracker *tracker;
+  double share;        // xthread_frees / num_frees, 0.0 - 1.0
+} leaklite_thread_xfree_t;
+
+extern leaklite_thread_slot_t leaklite_thread_slots[LEAKLITE_THREAD_SLOTS];
+extern __thread uint64_t leaklite_thread_owner;
+
+uint64_t leaklite_thread_claim();
+size_t leaklite_thread_usage(leaklite_thread_usage_t *out, size_t max_out);
+size_t leaklite_thread_rank_xfree(leaklite_thread_xfree_t *out, size_t max_out,
+                                  uint64_t min_frees);
+
+static inline uint64_t leaklite_thread_self()
+{
+  uint64_t owner = leaklite_thread_owner;
+  return owner ? owner : leaklite_thread_claim();
+}
+
+static inline uint64_t leaklite_thread_alloc(uint64_t size)
+{
+  uint64_t owner = leaklite_thread_self();
+  leaklite_thread_slot_t *slot = &leaklite_thread_slots[owner >> 32];
+  ck_pr_add_64(&slot->live_bytes, size);
+  ck_pr_inc_64(&slot->live_blocks);
+  return owner;
+}
+
+// Returns true when the block was allocated by another thread.
+static inline bool leaklite_thread_free(uint64_t owner, uint64_t size)
+{
+  leaklite_thread_slot_t *slot = &leaklite_thread_slots[owner >> 32];
+  if (ck_pr_load_32(&slot->generation) != (uint32_t)owner) {
+    slot = &leaklite_thread_slots[0];
+  }
+  ck_pr_sub_64(&slot->live_bytes, size);
+  ck_pr_dec_64(&slot->live_blocks);
+  return owner != leaklite_thread_self();
+}
+
+#endif
@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2020, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *    * Neither the name Circonus, Inc. nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include "util/leaklite.h"
+#include "util/leaklite_trace.h"
+
+// the tracer's own buffers must never be counted by leaklite itself
+#undef malloc
+#undef calloc
+#undef free
+
+#if (LEAKLITE_TRACE_BUFFER_SIZE & (LEAKLITE_TRACE_BUFFER_SIZE - 1)) != 0
+#error "LEAKLITE_TRACE_BUFFER_SIZE must be a power of 2"
+#endif
+
+// longest record: kind, site, type, two length-prefixed strings and a line number
+#define TRACE_MAX_STRING 255
+#define TRACE_MAX_RECORD (1 + 5 + 1 + 2 + TRACE_MAX_STRING + 2 + TRACE_MAX_STRING + 5)
+#define TRACE_MAX_EVENT (1 + 5 + 10 + 10 + 10)
+
+// Each thread appends to its own ring and the flusher drains it, so head is only written by the
+// owning thread and tail only by the flusher.  Buffers are never freed; a buffer whose thread
+// exited is handed to the next new thread once it has been drained.
+typedef struct leaklite_trace_buffer {
+  // written by the owning thread
+  uint64_t head;
+  uint64_t cached_tail;
+  uint64_t last_ptr;
+  uint64_t last_ts;
+  uint64_t dropped;
+  uint32_t epoch;
+  uint32_t thread;
+  // written by the flusher, kept off the owner's cache line
+  uint64_t tail __attribute__((aligned(64)));
+  uint32_t id;
+  unsigned int in_use;
+  struct leaklite_trace_buffer *next;
+  uint8_t data[LEAKLITE_TRACE_BUFFER_SIZE] __attribute__((aligned(64)));
+} leaklite_trace_buffer_t;
+
+unsigned int leaklite_trace_enabled = 0;
+
+static leaklite_trace_buffer_t *buffers = NULL;
+static uint32_t num_buffers = 0;
+static uint32_t num_threads = 0;
+static uint32_t num_sites = 0;
+static uint32_t epoch = 0;
+static __thread leaklite_trace_buffer_t *my_buffer = NULL;
+static pthread_key_t buffer_key;
+static pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+
+// Only start/stop and the flusher take this lock; allocating threads never do.
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t trace_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t flusher_thread;
+static bool running = false;
+static FILE *trace_file = NULL;
+
+static void trace_release_buffer(void *arg)
+{
+  leaklite_trace_buffer_t *buffer = (leaklite_trace_buffer_t *)arg;
+  // a later destructor on this thread that frees tracked memory claims a buffer afresh, rather
+  // than appending to this one while a new thread may already own it
+  my_buffer = NULL;
+  ck_pr_fence_store();
+  ck_pr_store_uint(&buffer->in_use, 0);
+}
+
+static void trace_create_key()
+{
+  pthread_key_create(&buffer_key, trace_release_buffer);
+}
+
+static leaklite_trace_buffer_t *trace_claim_buffer()
+{
+  leaklite_trace_buffer_t *buffer = (leaklite_trace_buffer_t *)ck_pr_load_ptr(&buffers);
+  while (buffer) {
+    if (!ck_pr_load_uint(&buffer->in_use) &&
+        ck_pr_load_64(&buffer->tail) == ck_pr_load_64(&buffer->head) &&
+        ck_pr_cas_uint(&buffer->in_use, 0, 1)) {
+      break;
+    }
+    buffer = buffer->next;
+  }
+  if (!buffer) {
+    buffer = (leaklite_trace_buffer_t *)leaklite_real_malloc(sizeof(leaklite_trace_buffer_t));
+    if (!buffer) {
+      return NULL;
+    }
+    buffer->head = 0;
+    buffer->tail = 0;
+    buffer->cached_tail = 0;
+    buffer->last_ptr = 0;
+    buffer->last_ts = 0;
+    buffer->dropped = 0;
+    buffer->epoch = ck_pr_load_32(&epoch);
+    buffer->id = ck_pr_faa_32(&num_buffers, 1) + 1;
+    buffer->in_use = 1;
+    leaklite_trace_buffer_t *head;
+    do {
+      head = (leaklite_trace_buffer_t *)ck_pr_load_ptr(&buffers);
+      buffer->next = head;
+      ck_pr_fence_store();
+    } while (!ck_pr_cas_ptr(&buffers, head, buffer));
+  }
+  buffer->thread = ck_pr_faa_32(&num_threads, 1);
+  pthread_once(&buffer_key_once, trace_create_key);
+  pthread_setspecific(buffer_key, buffer);
+  my_buffer = buffer;
+  return buffer;
+}
+
+static inline uint8_t *trace_put_varint(uint8_t *out, uint64_t value)
+{
+  while (value >= 0x80) {
+    *out++ = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = (uint8_t)value;
+  return out;
+}
+
+static inline uint8_t *trace_put_string(uint8_t *out, const char *str)
+{
+  size_t len = str ? strlen(str) : 0;
+  if (len > TRACE_MAX_STRING) {
+    // the tail of a path or signature is the part worth keeping
+    str += len - TRACE_MAX_STRING;
+    len = TRACE_MAX_STRING;
+  }
+  out = trace_put_varint(out, len);
+  memcpy(out, str, len);
+  return out + len;
+}
+
+static uint8_t *trace_put_site(uint8_t *out, leaklite_alloc_tracker_t *tracker, uint32_t site)
+{
+  *out++ = LEAKLITE_TRACE_SITE;
+  out = trace_put_varint(out, site);
+  *out++ = (uint8_t)tracker->type;
+  out = trace_put_string(out, tracker->fname);
+  out = trace_put_string(out, tracker->srcfile);
+  return trace_put_varint(out, tracker->linenum);
+}
+
+void leaklite_trace_event(int kind, leaklite_alloc_tracker_t *tracker, const void *ptr,
+                          uint64_t size)
+{
+  leaklite_trace_buffer_t *buffer = my_buffer;
+  if (!buffer && !(buffer = trace_claim_buffer())) {
+    return;
+  }
+  uint8_t record[TRACE_MAX_RECORD + TRACE_MAX_EVENT];
+  uint8_t *out = record;
+  uint64_t head = buffer->head;
+  uint64_t space = LEAKLITE_TRACE_BUFFER_SIZE - (head - buffer->cached_tail);
+  // only go to the flusher's cache line when the last known tail says the ring is full
+  if (space < TRACE_MAX_RECORD + TRACE_MAX_EVENT) {
+    buffer->cached_tail = ck_pr_load_64(&buffer->tail);
+    // and the owner's writes into that space must not move ahead of seeing the new tail
+    ck_pr_fence_acquire();
+    space = LEAKLITE_TRACE_BUFFER_SIZE - (head - buffer->cached_tail);
+  }
+
+  uint32_t site = ck_pr_load_32(&tracker->trace_id);
+  if (!site) {
+    // the thread that wins the id describes the site; room is checked first since nothing
+    // else fills this buffer in the meantime
+    if (space < TRACE_MAX_RECORD + TRACE_MAX_EVENT) {
+      ck_pr_inc_64(&buffer->dropped);
+      return;
+    }
+    uint32_t id = ck_pr_faa_32(&num_sites, 1) + 1;
+    if (ck_pr_cas_32(&tracker->trace_id, 0, id)) {
+      out = trace_put_site(out, tracker, id);
+    }
+    site = ck_pr_load_32(&tracker->trace_id);
+  }
+  else if (space < TRACE_MAX_EVENT) {
+    ck_pr_inc_64(&buffer->dropped);
+    return;
+  }
+
+  // a new trace file starts every delta chain from 0 again
+  uint32_t current = ck_pr_load_32(&epoch);
+  if (buffer->epoch != current) {
+    buffer->last_ptr = 0;
+    buffer->last_ts = 0;
+    buffer->epoch = current;
+  }
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  uint64_t now = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+  int64_t ptr_delta = (int64_t)((uint64_t)(uintptr_t)ptr - buffer->last_ptr);
+  *out++ = (uint8_t)kind;
+  out = trace_put_varint(out, site);
+  out = trace_put_varint(out, size);
+  out = trace_put_varint(out, ((uint64_t)ptr_delta << 1) ^ (uint64_t)(ptr_delta >> 63));
+  out = trace_put_varint(out, now - buffer->last_ts);
+  buffer->last_ptr = (uint64_t)(uintptr_t)ptr;
+  buffer->last_ts = now;
+
+  size_t len = out - record;
+  size_t pos = head & (LEAKLITE_TRACE_BUFFER_SIZE - 1);
+  size_t first = LEAKLITE_TRACE_BUFFER_SIZE - pos;
+  if (first >= len) {
+    memcpy(buffer->data + pos, record, len);
+  }
+  else {
+    memcpy(buffer->data + pos, record, first);
+    memcpy(buffer->data, record + first, len - first);
+  }
+  ck_pr_fence_store();
+  ck_pr_store_64(&buffer->head, head + len);
+}
+
+// Writes out whatever each buffer holds as one chunk per buffer, returns the bytes written.
+static uint64_t trace_flush()
+{
+  uint64_t written = 0;
+  leaklite_trace_buffer_t *buffer = (leaklite_trace_buffer_t *)ck_pr_load_ptr(&buffers);
+  while (buffer) {
+    uint64_t tail = buffer->tail;
+    uint64_t head = ck_pr_load_64(&buffer->head);
+    // pairs with the owner's store fence, the data up to head is complete once head is seen
+    ck_pr_fence_acquire();
+    if (head != tail) {
+      uint8_t header[15];
+      uint8_t *out = trace_put_varint(header, buffer->id);
+      out = trace_put_varint(out, buffer->thread);
+      out = trace_put_varint(out, head - tail);
+      fwrite(header, 1, out - header, trace_file);
+      size_t pos = tail & (LEAKLITE_TRACE_BUFFER_SIZE - 1);
+      size_t len = head - tail;
+      size_t first = LEAKLITE_TRACE_BUFFER_SIZE - pos;
+      if (first >= len) {
+        fwrite(buffer->data + pos, 1, len, trace_file);
+      }
+      else {
+        fwrite(buffer->data + pos, 1, first, trace_file);
+        fwrite(buffer->data, 1, len - first, trace_file);
+      }
+      // the reads above must be done before the owner is allowed to reuse the space
+      ck_pr_fence_release();
+      ck_pr_store_64(&buffer->tail, head);
+      written += len;
+    }
+    buffer = buffer->next;
+  }
+  return written;
+}
+
+static void *trace_flusher(void *arg)
+{
+  (void)arg;
+  pthread_mutex_lock(&trace_mutex);
+  while (running) {
+    // keep going while there is a backlog, otherwise sleep for one flush interval
+    if (trace_flush() > 0) {
+      continue;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += (long)LEAKLITE_TRACE_FLUSH_MS * 1000000;
+    while (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&trace_cond, &trace_mutex, &deadline);
+  }
+  pthread_mutex_unlock(&trace_mutex);
+  return NULL;
+}
+
+// Describes every site that has an id, or only the wrapped ones, in chunks from buffer 0.
+static void trace_describe_sites(bool wrapped_only)
+{
+  leaklite_alloc_tracker_t *tracker = (leaklite_alloc_tracker_t *)ck_pr_load_ptr(&tracker_head);
+  while (tracker) {
+    uint32_t site = ck_pr_load_32(&tracker->trace_id);
+#ifdef LEAKLITE_WRAP
+    if (wrapped_only && !leaklite_wrap_owns(tracker)) {
+      site = 0;
+    }
+#else
+    (void)wrapped_only;
+#endif
+    if (site) {
+      uint8_t record[TRACE_MAX_RECORD];
+      uint8_t header[15];
+      uint8_t *end = trace_put_site(record, tracker, site);
+      uint8_t *out = trace_put_varint(header, 0);
+      out = trace_put_varint(out, 0);
+      out = trace_put_varint(out, end - record);
+      fwrite(header, 1, out - header, trace_file);
+      fwrite(record, 1, end - record, trace_file);
+    }
+    tracker = tracker->next;
+  }
+}
+
+bool leaklite_trace_start(const char *path)
+{
+  pthread_mutex_lock(&trace_mutex);
+  if (running) {
+    pthread_mutex_unlock(&trace_mutex);
+    return false;
+  }
+  trace_file = fopen(path, "wb");
+  if (!trace_file) {
+    pthread_mutex_unlock(&trace_mutex);
+    return false;
+  }
+  fwrite(LEAKLITE_TRACE_MAGIC, 1, strlen(LEAKLITE_TRACE_MAGIC), trace_file);
+  // sites described in an earlier trace file are described again
+  trace_describe_sites(false);
+  // anything left over from a previous trace belongs to the old file
+  ck_pr_inc_32(&epoch);
+  leaklite_trace_buffer_t *buffer = (leaklite_trace_buffer_t *)ck_pr_load_ptr(&buffers);
+  while (buffer) {
+    buffer->tail = ck_pr_load_64(&buffer->head);
+    buffer = buffer->next;
+  }
+  running = true;
+  if (pthread_create(&flusher_thread, NULL, trace_flusher, NULL) != 0) {
+    running = false;
+    fclose(trace_file);
+    trace_file = NULL;
+    pthread_mutex_unlock(&trace_mutex);
+    return false;
+  }
+  ck_pr_store_uint(&leaklite_trace_enabled, 1);
+  pthread_mutex_unlock(&trace_mutex);
+  return true;
+}
+
+void leaklite_trace_stop()
+{
+  pthread_mutex_lock(&trace_mutex);
+  if (!running) {
+    pthread_mutex_unlock(&trace_mutex);
+    return;
+  }
+  ck_pr_store_uint(&leaklite_trace_enabled, 0);
+  running = false;
+  pthread_cond_signal(&trace_cond);
+  pthread_mutex_unlock(&trace_mutex);
+  pthread_join(flusher_thread, NULL);
+#ifdef LEAKLITE_WRAP
+  // wrapped sites were described unnamed at their first event, name them off the allocation
+  // path and describe them again, the analyzer keeps the last description of a site
+  leaklite_wrap_resolve();
+#endif
+  pthread_mutex_lock(&trace_mutex);
+  trace_flush();
+#ifdef LEAKLITE_WRAP
+  trace_describe_sites(true);
+#endif
+  fclose(trace_file);
+  trace_file = NULL;
+  pthread_mutex_unlock(&trace_mutex);
+}
+
+uint64_t leaklite_trace_dropped()
+{
+  uint64_t dropped = 0;
+  leaklite_trace_buffer_t *buffer = (leaklite_trace_buffer_t *)ck_pr_load_ptr(&buffers);
+  while (buffer) {
+    dropped += ck_pr_load_64(&buffer->dropped);
+    buffer = buffer->next;
+  }
+  return dropped;
+}
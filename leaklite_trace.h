@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2020, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *    * Neither the name Circonus, Inc. nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _UTILS_LEAKLITE_TRACE_H
+#define _UTILS_LEAKLITE_TRACE_H
+
+#include "ck_pr.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Trace file layout, all integers are LEB128 varints unless noted:
+//
+//   file:   "LLTRACE1" chunk*
+//   chunk:  buffer thread length record[length bytes]
+//   record: kind(1 byte) ...
+//     LEAKLITE_TRACE_ALLOC / LEAKLITE_TRACE_FREE:
+//             site size pointer_delta timestamp_delta
+//     LEAKLITE_TRACE_SITE:
+//             site type(1 byte) fname_len fname srcfile_len srcfile linenum
+//
+// pointer_delta is zigzag encoded against the previous pointer and timestamp_delta is in ns
+// against the previous timestamp, both per buffer, starting from 0.  A buffer is reused by a
+// new thread once its old one exits, so the delta chains follow the buffer, not the thread.
+// Buffers are numbered from 1; chunks from buffer 0 only hold LEAKLITE_TRACE_SITE records, for
+// sites that were first seen by an earlier trace and, at the end of the file, for wrapped sites
+// once they have names.  A later description of a site replaces an earlier one.
+#define LEAKLITE_TRACE_MAGIC "LLTRACE1"
+#define LEAKLITE_TRACE_ALLOC 0
+#define LEAKLITE_TRACE_FREE 1
+#define LEAKLITE_TRACE_SITE 2
+
+// per thread, must be a power of 2
+#ifndef LEAKLITE_TRACE_BUFFER_SIZE
+#define LEAKLITE_TRACE_BUFFER_SIZE (1 << 20)
+#endif
+#ifndef LEAKLITE_TRACE_FLUSH_MS
+#define LEAKLITE_TRACE_FLUSH_MS 10
+#endif
+
+struct leaklite_alloc_tracker;
+
+extern unsigned int leaklite_trace_enabled;
+
+bool leaklite_trace_start(const char *path);
+void leaklite_trace_stop();
+uint64_t leaklite_trace_dropped();
+void leaklite_trace_event(int kind, struct leaklite_alloc_tracker *tracker, const void *ptr,
+                          uint64_t size);
+
+static inline void leaklite_trace_alloc(struct leaklite_alloc_tracker *tracker, const void *ptr,
+                                        uint64_t size)
+{
+  if (ck_pr_load_uint(&leaklite_trace_enabled)) {
+    leaklite_trace_event(LEAKLITE_TRACE_ALLOC, tracker, ptr, size);
+  }
+}
+
+static inline void leaklite_trace_free(struct leaklite_alloc_tracker *tracker, const void *ptr,
+                                       uint64_t size)
+{
+  if (ck_pr_load_uint(&leaklite_trace_enabled)) {
+    leaklite_trace_event(LEAKLITE_TRACE_FREE, tracker, ptr, size);
+  }
+}
+
+#endif
@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2020, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *    * Neither the name Circonus, Inc. nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <errno.h>
+#include <limits.h>
+#include <dlfcn.h>
+#include <link.h>
+// this file only exists for the wrap mode, and always uses the tracker pointer signatures
+#ifndef LEAKLITE_WRAP
+#define LEAKLITE_WRAP
+#endif
+#ifndef NO_LAMBDA_LEAKLITE
+#define NO_LAMBDA_LEAKLITE 1
+#endif
+#include "util/leaklite.h"
+
+#undef malloc
+#undef calloc
+#undef free
+
+#if (LEAKLITE_WRAP_SITES & (LEAKLITE_WRAP_SITES - 1)) != 0
+#error "LEAKLITE_WRAP_SITES must be a power of 2"
+#endif
+#if LEAKLITE_WRAP_PROBE > LEAKLITE_WRAP_SITES
+#undef LEAKLITE_WRAP_PROBE
+#define LEAKLITE_WRAP_PROBE LEAKLITE_WRAP_SITES
+#endif
+
+#define WRAP_ADDR2LINE_BATCH 64
+
+typedef struct {
+  uint64_t addr;
+  bool resolved;
+  leaklite_alloc_tracker_t tracker;
+} leaklite_wrap_site_t;
+
+// Open addressed, insert only: a slot is claimed by CAS on its address and never released, so
+// lookups need no lock and a tracker never moves once handed out.
+static leaklite_wrap_site_t sites[LEAKLITE_WRAP_SITES];
+// callers that find no slot within LEAKLITE_WRAP_PROBE of their hash share this one
+static leaklite_wrap_site_t overflow_site = {
+  .addr = 1,
+  .resolved = true,
+  .tracker = {.fname = "(other callers)", .srcfile = "(leaklite wrap table crowded)",
+              .type = NOT_SET}};
+
+// Set while leaklite itself is allocating (pointer hash entries, trace buffers, dladdr), so
+// those calls go straight to the real allocator instead of recursing.
+static __thread bool in_wrap = false;
+
+// Names are worked out here first and published once per site, see leaklite_wrap_resolve.
+typedef struct {
+  uint32_t site;
+  uintptr_t addr;        // as addr2line wants it
+  const char *object;    // dladdr's name for the object, groups the addr2line runs
+  const char *fname;
+  const char *srcfile;
+  uint32_t linenum;
+} leaklite_wrap_pending_t;
+
+static pthread_mutex_t resolve_mutex = PTHREAD_MUTEX_INITIALIZER;
+static leaklite_wrap_pending_t pending[LEAKLITE_WRAP_SITES];
+
+// A tracker may be linked, and so dumped, as soon as it is handed out, so it must never be
+// handed out without names.  srcfile is set last everywhere, so once it is set fname is too.
+static inline leaklite_alloc_tracker_t *wrap_named(leaklite_wrap_site_t *site)
+{
+  if (!ck_pr_load_ptr(&site->tracker.srcfile)) {
+    ck_pr_cas_ptr(&site->tracker.fname, NULL, "?");
+    ck_pr_cas_ptr(&site->tracker.srcfile, NULL, "?");
+  }
+  return &site->tracker;
+}
+
+static inline leaklite_alloc_tracker_t *wrap_tracker(void *caller)
+{
+  uint64_t addr = (uint64_t)(uintptr_t)caller;
+  size_t mask = LEAKLITE_WRAP_SITES - 1;
+  size_t i = (size_t)((addr * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+  for (size_t probe = 0; probe < LEAKLITE_WRAP_PROBE; probe++, i = (i + 1) & mask) {
+    uint64_t key = ck_pr_load_64(&sites[i].addr);
+    if (key == addr) {
+      return wrap_named(&sites[i]);
+    }
+    if (key == 0) {
+      if (ck_pr_cas_64(&sites[i].addr, 0, addr) || ck_pr_load_64(&sites[i].addr) == addr) {
+        return wrap_named(&sites[i]);
+      }
+    }
+  }
+  return &overflow_site.tracker;
+}
+
+bool leaklite_wrap_owns(const leaklite_alloc_tracker_t *tracker)
+{
+  const char *p = (const char *)tracker;
+  return p >= (const char *)sites && p < (const char *)(sites + LEAKLITE_WRAP_SITES);
+}
+
+void *__wrap_malloc(size_t size)
+{
+  if (in_wrap) {
+    return __real_malloc(size);
+  }
+  if (size > SIZE_MAX - sizeof(leaklite_trailer_t)) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  in_wrap = true;
+  void *ret = leaklite_malloc(size, NULL, wrap_tracker(__builtin_return_address(0)));
+  in_wrap = false;
+  return ret;
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+  if (in_wrap) {
+    return __real_calloc(count, size);
+  }
+  if (size && count > SIZE_MAX / size) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  in_wrap = true;
+  void *ret = leaklite_calloc(count, size, NULL, wrap_tracker(__builtin_return_address(0)));
+  in_wrap = false;
+  return ret;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+  if (in_wrap) {
+    return __real_realloc(ptr, size);
+  }
+  void *caller = __builtin_return_address(0);
+  void *ret = NULL;
+  in_wrap = true;
+  leaklite_trailer_t **trailer = ptr ? (leaklite_trailer_t **)pointer_hash_get(ptr) : NULL;
+  if (ptr && !trailer) {
+    // allocated before wrapping started, or by a shared library
+    ret = __real_realloc(ptr, size);
+  }
+  else if (ptr && size == 0) {
+    leaklite_free(ptr, NULL, NULL, 0);
+  }
+  else if (size > SIZE_MAX - sizeof(leaklite_trailer_t)) {
+    errno = ENOMEM;
+  }
+  else {
+    // the trailer sits right after the block, so a tracked block always moves
+    ret = leaklite_alloc(size, NULL, wrap_tracker(caller), REALLOC);
+    if (ret && ptr) {
+      uint64_t old_size = (char *)*trailer - (char *)ptr;
+      memcpy(ret, ptr, old_size < size ? old_size : size);
+      leaklite_free(ptr, NULL, NULL, 0);
+    }
+  }
+  in_wrap = false;
+  return ret;
+}
+
+void __wrap_free(void *ptr)
+{
+  if (in_wrap) {
+    __real_free(ptr);
+    return;
+  }
+  in_wrap = true;
+  leaklite_free(ptr, NULL, NULL, 0);
+  in_wrap = false;
+}
+
+#ifndef NO_ADDR2LINE_LEAKLITE
+// Fills in function, file and line for up to WRAP_ADDR2LINE_BATCH sites of one object with a
+// single addr2line run.  Sites it cannot place keep what dladdr found.
+static void wrap_addr2line(leaklite_wrap_pending_t *batch, size_t count)
+{
+  char cmd[64 + PATH_MAX + WRAP_ADDR2LINE_BATCH * 20];
+  const char *object = batch[0].object;
+  if (strchr(object, '\'')) {
+    return;
+  }
+  int len = snprintf(cmd, sizeof(cmd), "addr2line -f -C -e '%s'", object);
+  for (size_t i = 0; i < count && len < (int)sizeof(cmd); i++) {
+    len += snprintf(cmd + len, sizeof(cmd) - len, " 0x%" PRIxPTR, batch[i].addr);
+  }
+  if (len >= (int)sizeof(cmd)) {
+    return;
+  }
+  FILE *out = popen(cmd, "r");
+  if (!out) {
+    return;
+  }
+  char func[1024], where[PATH_MAX + 64];
+  for (size_t i = 0; i < count; i++) {
+    if (!fgets(func, sizeof(func), out) || !fgets(where, sizeof(where), out)) {
+      break;
+    }
+    func[strcspn(func, "\n")] = '\0';
+    where[strcspn(where, "\n")] = '\0';
+    char *colon = strrchr(where, ':');
+    if (!colon || strncmp(where, "??", 2) == 0) {
+      continue;
+    }
+    *colon = '\0';
+    if (strcmp(func, "??") != 0) {
+      batch[i].fname = strdup(func);
+    }
+    batch[i].srcfile = strdup(where);
+    batch[i].linenum = (uint32_t)strtoul(colon + 1, NULL, 10);
+  }
+  pclose(out);
+}
+#endif
+
+// Dumps may be walking the trackers meanwhile, so each site goes from its "?" placeholders to
+// its final names in one step; a reader sees either, or at worst "?" next to a final name.
+void leaklite_wrap_resolve()
+{
+  pthread_mutex_lock(&resolve_mutex);
+  bool was_in_wrap = in_wrap;
+  in_wrap = true;
+  size_t num_pending = 0;
+  for (uint32_t i = 0; i < LEAKLITE_WRAP_SITES; i++) {
+    leaklite_wrap_site_t *site = &sites[i];
+    uint64_t addr = ck_pr_load_64(&site->addr);
+    if (!addr || site->resolved) {
+      continue;
+    }
+    leaklite_wrap_pending_t *entry = &pending[num_pending++];
+    entry->site = i;
+    entry->object = NULL;
+    entry->fname = "?";
+    entry->srcfile = "?";
+    entry->linenum = 0;
+    // the return address is the instruction after the call, step back into the call itself
+    Dl_info info;
+    if (dladdr((void *)(uintptr_t)(addr - 1), &info) && info.dli_fname) {
+      entry->object = info.dli_fname;
+      entry->fname = info.dli_sname ? info.dli_sname : "?";
+      entry->srcfile = info.dli_fname;
+      // addr2line wants file offsets for position independent objects
+      const ElfW(Ehdr) *ehdr = (const ElfW(Ehdr) *)info.dli_fbase;
+      entry->addr = ehdr->e_type == ET_DYN ? (uintptr_t)(addr - 1) - (uintptr_t)info.dli_fbase
+                                           : (uintptr_t)(addr - 1);
+    }
+    site->resolved = true;
+  }
+#ifndef NO_ADDR2LINE_LEAKLITE
+  // batch the lookups per object, dladdr hands out the same name pointer for each object
+  size_t done = 0;
+  while (done < num_pending) {
+    const char *object = pending[done].object;
+    if (!object) {
+      done++;
+      continue;
+    }
+    size_t first = done;
+    for (size_t i = done; i < num_pending && done - first < WRAP_ADDR2LINE_BATCH; i++) {
+      if (pending[i].object == object) {
+        // move it in front of the remaining work
+        leaklite_wrap_pending_t swap = pending[done];
+        pending[done] = pending[i];
+        pending[i] = swap;
+        done++;
+      }
+    }
+    wrap_addr2line(&pending[first], done - first);
+  }
+#endif
+  for (size_t i = 0; i < num_pending; i++) {
+    leaklite_alloc_tracker_t *tracker = &sites[pending[i].site].tracker;
+    ck_pr_store_32(&tracker->linenum, pending[i].linenum);
+    ck_pr_store_ptr(&tracker->fname, pending[i].fname);
+    ck_pr_fence_store();
+    ck_pr_store_ptr(&tracker->srcfile, pending[i].srcfile);
+  }
+  in_wrap = was_in_wrap;
+  pthread_mutex_unlock(&resolve_mutex);
+}
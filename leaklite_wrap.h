@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2020, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following
+ *      disclaimer in the documentation and/or other materials provided
+ *      with the distribution.
+ *    * Neither the name Circonus, Inc. nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _UTILS_LEAKLITE_WRAP_H
+#define _UTILS_LEAKLITE_WRAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Link with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free and leaklite_wrap.c to
+// track every allocation made from the objects in that link, keyed by the caller's return
+// address.  Shared libraries call the real allocator directly and are not covered.
+
+// one tracker per distinct return address, must be a power of 2
+#ifndef LEAKLITE_WRAP_SITES
+#define LEAKLITE_WRAP_SITES 8192
+#endif
+
+// slots looked at per call before a caller is sent to the shared "(other callers)" tracker,
+// bounds the lookup once the table is full or crowded
+#ifndef LEAKLITE_WRAP_PROBE
+#define LEAKLITE_WRAP_PROBE 32
+#endif
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t count, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+void __wrap_free(void *ptr);
+
+// Names the return-address trackers that have not been named yet.  Called by leaklite_dump,
+// anything else that lists trackers should call it first.
+void leaklite_wrap_resolve();
+
+struct leaklite_alloc_tracker;
+
+// true for the return-address trackers handed out by the wrap functions
+bool leaklite_wrap_owns(const struct leaklite_alloc_tracker *tracker);
+
+#endif
@@ -32,6 +32,16 @@
 #include <pthread.h>
 #include "util/pointer_hash.h"
 
+#ifdef LEAKLITE_WRAP
+// the hash is leaklite's own bookkeeping, keep it out of the wrapped allocator
+void *__real_malloc(size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+#define malloc(size) __real_malloc(size)
+#define realloc(ptr, size) __real_realloc(ptr, size)
+#define free(ptr) __real_free(ptr)
+#endif
+
 static bool initialized = false;
 
 static ck_ht_t pointer_hash;
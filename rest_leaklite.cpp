@@ -34,39 +34,94 @@ extern "C" {
 #include <mtev_rest.h>
 #include <mtev_http.h>
 #include "util/circ_util.h"
+#include "util/leaklite_history.h"
 }
 #include "util/leaklite.hpp"
 
+static void rest_leaklite_dump_row(mtev_http_session_ctx *ctx, leaklite_alloc_tracker_t *curr)
+{
+  mtev_http_response_appendf(ctx, "<tr><code><td align=\"right\">%10" PRIu64 "</td>", curr->active_memsize);
+#ifdef LEAKLITE_JEMALLOC
+  mtev_http_response_appendf(ctx, "<td align=\"right\">%10" PRIu64 "</td>", curr->active_usable);
+#endif
+#ifdef LEAKLITE_RESIDENT
+  mtev_http_response_appendf(ctx, "<td align=\"right\">%10" PRIu64 "</td>", curr->active_resident);
+#endif
+  mtev_http_response_appendf(ctx,
+                            "<td align=\"right\">%10" PRIu64 "</td><td align=\"right\">%10" PRIu64
+                            "</td><td align=\"center\">%s</td><td align=\"center\">%s</td><td align=\"center\">%s:%u</td></code></tr>",
+                            curr->active_allocs, curr->num_frees,
+                            leaklite_type_str[curr->type], curr->fname,
+                            curr->srcfile, curr->linenum);
+}
+
 static int rest_get_leaklite_dump(mtev_http_rest_closure_t *restc, int npats, char **pats)
 {
   mtev_http_session_ctx *ctx = restc->http_ctx;
+  int columns = 6;
+#ifdef LEAKLITE_RESIDENT
+  uint64_t resident_pages = LEAKLITE_RESIDENT_SCAN_PAGES;
+  const char *pages_str = mtev_http_request_querystring(mtev_http_session_request(ctx), "resident_pages");
+  if (pages_str) {
+    resident_pages = strtoull(pages_str, NULL, 10);
+    if (resident_pages > LEAKLITE_RESIDENT_SCAN_PAGES_MAX) {
+      resident_pages = LEAKLITE_RESIDENT_SCAN_PAGES_MAX;
+    }
+  }
+  leaklite_resident_scan(resident_pages);
+#endif
   mtev_http_response_ok(ctx, "text/html");
-  mtev_http_response_append(ctx, CIRC_STR_THEN_STRSIZE("<html><head><meta http-equiv=\"refresh\" content=\"5\"></head><body><h3>IRONDB LEAKLITE MEMORY DUMP<h3><table><tr><th>Bytes</th><th>Unfreed</th><th>Freed</th><th>Type</th><th>Function</th><th>Source File/Line</th></tr>\n"));
+#ifdef LEAKLITE_WRAP
+  leaklite_wrap_resolve();
+#endif
+  mtev_http_response_append(ctx, CIRC_STR_THEN_STRSIZE("<html><head><meta http-equiv=\"refresh\" content=\"5\"></head><body><h3>IRONDB LEAKLITE MEMORY DUMP<h3><table><tr><th>Bytes</th>"));
+#ifdef LEAKLITE_JEMALLOC
+  mtev_http_response_append(ctx, CIRC_STR_THEN_STRSIZE("<th>Usable</th>"));
+  columns++;
+#endif
+#ifdef LEAKLITE_RESIDENT
+  mtev_http_response_append(ctx, CIRC_STR_THEN_STRSIZE("<th>Resident</th>"));
+  columns++;
+#endif
+  mtev_http_response_append(ctx, CIRC_STR_THEN_STRSIZE("<th>Unfreed</th><th>Freed</th><th>Type</th><th>Function</th><th>Source File/Line</th></tr>\n"));
   leaklite_alloc_tracker_t *curr = tracker_head;
   uint64_t total = 0;
+#ifdef LEAKLITE_JEMALLOC
+  uint64_t total_usable = 0;
+#endif
   while (curr) {
     if (curr->active_memsize > 1048576) {
-      mtev_http_response_appendf(ctx,
-                                "<tr><code><td align=\"right\">%10" PRIu64 "</td><td align=\"right\">%10" PRIu64 "</td><td align=\"right\">%10" PRIu64
-                                "</td><td align=\"center\">%s</td><td align=\"center\">%s</td><td align=\"center\">%s:%u</td></code></tr>",
-                                curr->active_memsize, curr->active_allocs, curr->num_frees,
-                                leaklite_type_str[curr->type], curr->fname,
-                                curr->srcfile, curr->linenum);
+      rest_leaklite_dump_row(ctx, curr);
     }
     total = total + curr->active_memsize;
+#ifdef LEAKLITE_JEMALLOC
+    total_usable = total_usable + curr->active_usable;
+#endif
     curr = curr->next;
   }
-  mtev_http_response_appendf(ctx, "<tr><code><td colspan=\"6\">%.10" PRIu64 " total monitored allocated memory</td></code></tr>", total);
-  mtev_http_response_appendf(ctx, "<tr><td colspan=\"6\"></td></tr>");
+  mtev_http_response_appendf(ctx, "<tr><code><td colspan=\"%d\">%.10" PRIu64 " total monitored allocated memory</td></code></tr>", columns, total);
+#ifdef LEAKLITE_JEMALLOC
+  mtev_http_response_appendf(ctx, "<tr><code><td colspan=\"%d\">%.10" PRIu64 " total usable, trailers included</td></code></tr>", columns, total_usable);
+#ifdef LEAKLITE_JEMALLOC_ARENA
+  size_t allocated, resident, mapped;
+  if (leaklite_jemalloc_arena_stats(&allocated, &resident, &mapped)) {
+    mtev_http_response_appendf(ctx, "<tr><code><td colspan=\"%d\">%zu allocated, %zu resident, %zu mapped in the leaklite arena</td></code></tr>",
+                               columns, allocated, resident, mapped);
+  }
+#endif
+#endif
+#ifdef LEAKLITE_RESIDENT
+  leaklite_resident_stats_t large;
+  leaklite_resident_stats(&large);
+  mtev_http_response_appendf(ctx, "<tr><code><td colspan=\"%d\">%.10" PRIu64 " of %" PRIu64 " bytes resident in %" PRIu64 " blocks of at least %u bytes (%" PRIu64 " full passes)</td></code></tr>",
+                             columns, large.resident, large.bytes, large.blocks,
+                             (unsigned)LEAKLITE_RESIDENT_MIN, large.passes);
+#endif
+  mtev_http_response_appendf(ctx, "<tr><td colspan=\"%d\"></td></tr>", columns);
   curr = tracker_head;
   while (curr) {
     if (curr->active_memsize <= 1048576) {
-      mtev_http_response_appendf(ctx,
-                                "<tr><code><td align=\"right\">%10" PRIu64 "</td><td align=\"right\">%10" PRIu64 "</td><td align=\"right\">%10" PRIu64
-                                "</td><td align=\"center\">%s</td><td align=\"center\">%s</td><td align=\"center\">%s:%u</td></code></tr>",
-                                curr->active_memsize, curr->active_allocs, curr->num_frees,
-                                leaklite_type_str[curr->type], curr->fname,
-                                curr->srcfile, curr->linenum);
+      rest_leaklite_dump_row(ctx, curr);
     }
     curr = curr->next;
   }
@@ -76,9 +131,99 @@ static int rest_get_leaklite_dump(mtev_http_rest_closure_t *restc, int npats, ch
   return 0;
 }
 
+#define LEAKLITE_GROWTH_ROWS 100
+
+static int rest_get_leaklite_growth(mtev_http_rest_closure_t *restc, int npats, char **pats)
+{
+  mtev_http_session_ctx *ctx = restc->http_ctx;
+  double min_confidence = 0.5;
+  const char *conf_str = mtev_http_request_querystring(mtev_http_session_request(ctx), "confidence");
+  if (conf_str) {
+    min_confidence = strtod(conf_str, NULL);
+  }
+  mtev_http_response_ok(ctx, "text/html");
+  uint32_t interval_ms = leaklite_history_interval_ms();
+  if (!interval_ms) {
+    mtev_http_response_append(ctx, CIRC_STR_THEN_STRSIZE("<html><body><h3>IRONDB LEAKLITE GROWTH</h3>The leaklite history sampler is not running (see leaklite_history_start).</body></html>"));
+    mtev_http_response_end(ctx);
+    return 0;
+  }
+#ifdef LEAKLITE_WRAP
+  leaklite_wrap_resolve();
+#endif
+  leaklite_history_growth_t rows[LEAKLITE_GROWTH_ROWS];
+  size_t count = leaklite_history_rank(rows, LEAKLITE_GROWTH_ROWS, min_confidence);
+  mtev_http_response_appendf(ctx, "<html><head><meta http-equiv=\"refresh\" content=\"%u\"></head><body><h3>IRONDB LEAKLITE GROWTH (sampled every %u ms, confidence &gt;= %.2f)<h3><table><tr><th>Bytes/sec</th><th>Confidence</th><th>Growth</th><th>Samples</th><th>Bytes</th><th>Unfreed</th><th>Type</th><th>Function</th><th>Source File/Line</th></tr>\n",
+                             interval_ms < 5000 ? 5 : interval_ms / 1000, interval_ms, min_confidence);
+  for (size_t i = 0; i < count; i++) {
+    leaklite_alloc_tracker_t *curr = rows[i].tracker;
+    mtev_http_response_appendf(ctx,
+                               "<tr><code><td align=\"right\">%.1f</td><td align=\"right\">%.3f</td><td align=\"right\">%10" PRId64 "</td><td align=\"right\">%u</td><td align=\"right\">%10" PRIu64 "</td><td align=\"right\">%10" PRIu64
+                               "</td><td align=\"center\">%s</td><td align=\"center\">%s</td><td align=\"center\">%s:%u</td></code></tr>",
+                               rows[i].slope, rows[i].confidence, rows[i].growth, rows[i].samples,
+                               curr->active_memsize, curr->active_allocs,
+                               leaklite_type_str[curr->type], curr->fname,
+                               curr->srcfile, curr->linenum);
+  }
+  mtev_http_response_appendf(ctx, "</table></body></html>");
+
+  mtev_http_response_end(ctx);
+  return 0;
+}
+
+#ifdef LEAKLITE_THREADS
+#define LEAKLITE_XFREE_ROWS 100
+
+static int rest_get_leaklite_threads(mtev_http_rest_closure_t *restc, int npats, char **pats)
+{
+  mtev_http_session_ctx *ctx = restc->http_ctx;
+  uint64_t min_frees = 100;
+  const char *frees_str = mtev_http_request_querystring(mtev_http_session_request(ctx), "min_frees");
+  if (frees_str) {
+    min_frees = strtoull(frees_str, NULL, 10);
+  }
+#ifdef LEAKLITE_WRAP
+  leaklite_wrap_resolve();
+#endif
+  mtev_http_response_ok(ctx, "text/html");
+  mtev_http_response_append(ctx, CIRC_STR_THEN_STRSIZE("<html><head><meta http-equiv=\"refresh\" content=\"5\"></head><body><h3>IRONDB LEAKLITE THREADS<h3><table><tr><th>Bytes</th><th>Unfreed</th><th>Thread</th><th>Name</th><th>Slot</th></tr>\n"));
+  leaklite_thread_usage_t threads[LEAKLITE_THREAD_SLOTS];
+  size_t num_threads = leaklite_thread_usage(threads, LEAKLITE_THREAD_SLOTS);
+  for (size_t i = 0; i < num_threads; i++) {
+    mtev_http_response_appendf(ctx,
+                               "<tr><code><td align=\"right\">%10" PRIu64 "</td><td align=\"right\">%10" PRIu64
+                               "</td><td align=\"right\">%d</td><td align=\"center\">%s</td><td align=\"right\">%u</td></code></tr>",
+                               threads[i].live_bytes, threads[i].live_blocks, (int)threads[i].tid,
+                               threads[i].name, threads[i].slot);
+  }
+  mtev_http_response_appendf(ctx, "</table><h3>CROSS-THREAD FREES (sites with at least %" PRIu64 " frees)</h3><table><tr><th>Share</th><th>Cross-thread</th><th>Freed</th><th>Bytes</th><th>Unfreed</th><th>Type</th><th>Function</th><th>Source File/Line</th></tr>\n",
+                             min_frees);
+  leaklite_thread_xfree_t rows[LEAKLITE_XFREE_ROWS];
+  size_t count = leaklite_thread_rank_xfree(rows, LEAKLITE_XFREE_ROWS, min_frees);
+  for (size_t i = 0; i < count; i++) {
+    leaklite_alloc_tracker_t *curr = rows[i].tracker;
+    mtev_http_response_appendf(ctx,
+                               "<tr><code><td align=\"right\">%.3f</td><td align=\"right\">%10" PRIu64 "</td><td align=\"right\">%10" PRIu64 "</td><td align=\"right\">%10" PRIu64 "</td><td align=\"right\">%10" PRIu64
+                               "</td><td align=\"center\">%s</td><td align=\"center\">%s</td><td align=\"center\">%s:%u</td></code></tr>",
+                               rows[i].share, curr->xthread_frees, curr->num_frees,
+                               curr->active_memsize, curr->active_allocs,
+                               leaklite_type_str[curr->type], curr->fname,
+                               curr->srcfile, curr->linenum);
+  }
+  mtev_http_response_appendf(ctx, "</table></body></html>");
+
+  mtev_http_response_end(ctx);
+  return 0;
+}
+#endif
+
 extern "C" {
 void rest_leaklite_init()
 {
   mtevAssert(mtev_http_rest_register("GET", "/", "^leaklite$", rest_get_leaklite_dump) == 0);
+  mtevAssert(mtev_http_rest_register("GET", "/", "^leaklite/growth$", rest_get_leaklite_growth) == 0);
+#ifdef LEAKLITE_THREADS
+  mtevAssert(mtev_http_rest_register("GET", "/", "^leaklite/threads$", rest_get_leaklite_threads) == 0);
+#endif
 }
 }